@@ -1,4 +1,5 @@
 #! /bin/sh
+libtoolize -c
 aclocal
 autoheader
 automake -af
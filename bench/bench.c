@@ -0,0 +1,237 @@
+/* bench.c - time the stages of the jvqplot pipeline
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <cairo.h>
+
+#include "jvqplot.h"
+
+
+/* Every repetition reads the file into a new state, so that neither
+ * the reuse of unchanged datasets nor the drawing caches make later
+ * repetitions cheaper.  Only with --append one state is kept, to time
+ * reading the appended rows.
+ *
+ * Every result is printed as one line of the form
+ *
+ *   BENCH name=NAME stage=STAGE reps=N rows=R bytes=B p50=T p90=T p99=T
+ *         mb/s=X points/s=Y
+ *
+ * where the latencies T are given in microseconds, R and B give the
+ * size of the input for the last repetition, and the throughputs are
+ * averaged over all repetitions.  For the parse stage, points/s
+ * counts rows of the input file.  */
+
+enum {
+  B_PARSE, B_UPDATE, B_LAYOUT, B_DRAW, N_BENCH
+};
+static const char *const bench_name[N_BENCH] = {
+  "parse", "update", "layout", "draw",
+};
+
+
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double
+percentile(double *sorted, int n, double q)
+{
+  int i = ceil(q*n) - 1;
+  return sorted[CLAMP(i, 0, n-1)];
+}
+
+static void
+report(const char *name, int stage, double *usec, int n,
+       double rows, gsize bytes, double total_bytes, double total_points)
+{
+  double total_usec = 0;
+  int i;
+
+  for (i=0; i<n; ++i) total_usec += usec[i];
+  if (total_usec <= 0) total_usec = 1;
+  qsort(usec, n, sizeof(double), compare_double);
+  printf("BENCH name=%s stage=%s reps=%d rows=%.0f bytes=%" G_GSIZE_FORMAT
+         " p50=%.1f p90=%.1f p99=%.1f mb/s=%.2f points/s=%.4g\n",
+         name, bench_name[stage], n, rows, bytes,
+         percentile(usec, n, .5), percentile(usec, n, .9),
+         percentile(usec, n, .99),
+         total_bytes / total_usec, total_points / total_usec * 1e6);
+}
+
+static gsize
+write_prefix(const gchar *contents, gsize length, gsize want,
+             const gchar *path)
+/* Write the first `want' bytes of `contents', extended to the next
+ * line break, to `path'.  */
+{
+  GError *err = NULL;
+
+  while (want < length && contents[want-1] != '\n') want += 1;
+  if (want > length) want = length;
+  if (! g_file_set_contents(path, contents, want, &err)) {
+    fprintf(stderr, "error: %s\n", err->message);
+    exit(1);
+  }
+  return want;
+}
+
+int
+main(int argc, char **argv)
+{
+  GError *err = NULL;
+  int reps = 10;
+  int append = 0;
+  int width = 800;
+  int height = 600;
+
+  GOptionEntry entries[] = {
+    { "reps", 'r', 0, G_OPTION_ARG_INT, &reps,
+      "Repeat every measurement N times", "N" },
+    { "append", 'a', 0, G_OPTION_ARG_INT, &append,
+      "Read the file in N growing pieces, as if it was appended to", "N" },
+    { "width", 0, 0, G_OPTION_ARG_INT, &width,
+      "Width of the image in pixels", "W" },
+    { "height", 0, 0, G_OPTION_ARG_INT, &height,
+      "Height of the image in pixels", "H" },
+    { NULL, '\0', 0, 0, NULL, NULL, NULL }
+  };
+  GOptionContext *context = g_option_context_new("name datafile");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_set_help_enabled(context, TRUE);
+  if (! g_option_context_parse(context, &argc, &argv, &err)) {
+    fprintf(stderr, "%s\n", err->message);
+    exit(1);
+  }
+  g_option_context_free(context);
+  if (argc != 3 || reps < 1) {
+    fprintf(stderr, "usage: jvqplot-bench [options] name datafile\n");
+    exit(1);
+  }
+  const char *name = argv[1];
+
+  gchar *contents;
+  gsize length;
+  if (! g_file_get_contents(argv[2], &contents, &length, &err)) {
+    fprintf(stderr, "error: %s\n", err->message);
+    exit(1);
+  }
+
+  gchar *path = NULL;
+  GFile *file;
+  if (append > 0) {
+    int fd = g_file_open_tmp("jvqplot-bench-XXXXXX", &path, &err);
+    if (fd < 0) {
+      fprintf(stderr, "error: %s\n", err->message);
+      exit(1);
+    }
+    close(fd);
+    file = g_file_new_for_path(path);
+    reps = append;
+  } else {
+    file = g_file_new_for_commandline_arg(argv[2]);
+  }
+
+  struct state *state = NULL;
+  cairo_surface_t *surface
+    = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+
+  double *usec[N_BENCH];
+  int b, i, k;
+  for (b=0; b<N_BENCH; ++b) usec[b] = g_new(double, reps);
+  gsize bytes = length;
+  double rows = 0, total_bytes = 0, total_rows = 0, total_points = 0;
+  for (i=0; i<reps; ++i) {
+    if (append > 0) {
+      bytes = write_prefix(contents, length, length*(i+1)/append, path);
+    }
+    if (! state || append == 0) {
+      if (state) delete_state(state);
+      state = new_state();
+      add_source(state, file);
+    }
+
+    read_data(state, 0);
+    usec[B_PARSE][i]
+      = state->stats.usec[STAGE_OPEN] + state->stats.usec[STAGE_PARSE];
+    usec[B_UPDATE][i] = state->stats.usec[STAGE_UPDATE];
+    if (! state->dataset_used) {
+      fprintf(stderr, "error: no data in \"%s\"\n", argv[2]);
+      exit(1);
+    }
+
+    gint64 t0 = g_get_monotonic_time();
+    struct layout *L = new_layout(width, height,
+                                  state->xres, state->yres,
+                                  state->min[0], state->max[0],
+                                  state->min[1], state->max[1],
+                                  state->time_axis);
+    gint64 t1 = g_get_monotonic_time();
+    cairo_t *cr = cairo_create(surface);
+    draw_graph(state, cr, L, FALSE);
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+    gint64 t2 = g_get_monotonic_time();
+    usec[B_LAYOUT][i] = t1 - t0;
+    usec[B_DRAW][i] = t2 - t1;
+    delete_layout(L);
+
+    rows = 0;
+    for (k=0; k<state->dataset_used; ++k) {
+      rows += state->dataset[k].rows;
+      total_points
+        += (double)state->dataset[k].rows * (state->dataset[k].cols-1);
+    }
+    total_rows += rows;
+    total_bytes += bytes;
+  }
+
+  report(name, B_PARSE, usec[B_PARSE], reps, rows, bytes,
+         total_bytes, total_rows);
+  report(name, B_UPDATE, usec[B_UPDATE], reps, rows, bytes,
+         0, total_points);
+  report(name, B_LAYOUT, usec[B_LAYOUT], reps, rows, bytes, 0, 0);
+  report(name, B_DRAW, usec[B_DRAW], reps, rows, bytes, 0, total_points);
+
+  if (path) {
+    g_unlink(path);
+    g_free(path);
+  }
+  g_object_unref(file);
+  delete_state(state);
+  cairo_surface_destroy(surface);
+  g_free(contents);
+  return 0;
+}
@@ -0,0 +1,160 @@
+/* gen-data.c - generate synthetic data files for benchmarking
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+
+/* a fixed generator, so that the output is the same on all systems */
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static double
+uniform(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (rng_state >> 11) * (1.0/9007199254740992.0);
+}
+
+static void
+gen_long(long n)
+/* one column, the row index is added by jvqplot */
+{
+  double x = 0;
+  long i;
+
+  for (i=0; i<n; ++i) {
+    x += uniform() - .5;
+    printf("%.6g\n", x);
+  }
+}
+
+static void
+gen_wide(long n)
+/* a spectrogram-like matrix with 500 value columns */
+{
+  int cols = 500;
+  long rows = n / cols + 1;
+  long i;
+  int j;
+
+  for (i=0; i<rows; ++i) {
+    printf("%ld", i);
+    for (j=0; j<cols; ++j) {
+      printf(" %.4g", sin(i*.01*(j+1)) + .1*uniform());
+    }
+    putchar('\n');
+  }
+}
+
+static void
+gen_blocks(long n)
+/* many small data sets, separated by blank lines */
+{
+  long i;
+
+  for (i=0; i<n; ++i) {
+    if (i > 0 && i%100 == 0) putchar('\n');
+    printf("%ld %.6g\n", i%100, i/100 + uniform());
+  }
+}
+
+static void
+gen_scatter(long n)
+/* an unordered point cloud */
+{
+  long i;
+
+  for (i=0; i<n; ++i) {
+    double r = sqrt(-2*log(1-uniform()));
+    double phi = 2*M_PI*uniform();
+    printf("%.6g %.6g\n", r*cos(phi), r*sin(phi));
+  }
+}
+
+static void
+gen_time(long n)
+/* a log with ISO 8601 timestamps, to compare with "scatter" */
+{
+  double t = 1325376000;        /* 2012-01-01 00:00:00 UTC */
+  long i;
+
+  for (i=0; i<n; ++i) {
+    time_t sec = t;
+    struct tm *tm = gmtime(&sec);
+    printf("%04d-%02d-%02dT%02d:%02d:%02d.%03dZ %.6g\n",
+           tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday,
+           tm->tm_hour, tm->tm_min, tm->tm_sec, (int)((t-sec)*1000),
+           uniform());
+    t += 10*uniform();
+  }
+}
+
+static void
+gen_append(long n)
+/* time series with several columns, read in growing prefixes by the
+ * benchmark */
+{
+  double y[4] = { 0, 0, 0, 0 };
+  long i;
+  int j;
+
+  for (i=0; i<n; ++i) {
+    printf("%ld", i);
+    for (j=0; j<4; ++j) {
+      y[j] += uniform() - .5;
+      printf(" %.6g", y[j]);
+    }
+    putchar('\n');
+  }
+}
+
+static const struct {
+  const char *name;
+  void (*gen)(long n);
+} shapes[] = {
+  { "long", gen_long },
+  { "wide", gen_wide },
+  { "blocks", gen_blocks },
+  { "scatter", gen_scatter },
+  { "time", gen_time },
+  { "append", gen_append },
+};
+
+int
+main(int argc, char **argv)
+{
+  size_t i;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: gen-data shape n\n");
+    return 1;
+  }
+  for (i=0; i<sizeof(shapes)/sizeof(shapes[0]); ++i) {
+    if (strcmp(argv[1], shapes[i].name) == 0) {
+      shapes[i].gen(atol(argv[2]));
+      return 0;
+    }
+  }
+  fprintf(stderr, "error: unknown shape \"%s\"\n", argv[1]);
+  return 1;
+}
@@ -0,0 +1,325 @@
+/* latency.c - measure the delay between writing data and a new plot
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <cairo.h>
+
+#include "jvqplot.h"
+
+
+/* A writer thread appends `rows' lines to the data file (or rewrites
+ * the file with one more block of lines) `rate' times per second.
+ * The data file has the row number in its first column, so after
+ * every reload the number of rows tells us which write is shown.
+ * The result is printed as one line of the form
+ *
+ *   LATENCY mode=M monitor=B rate=R rows=N writes=W frames=F
+ *           coalesced=C dropped=D p50=T p90=T p99=T max=T cpu_user=U
+ *           cpu_sys=S events=E cpu_idle=I
+ *
+ * where all times are in microseconds.  `coalesced' counts writes
+ * which were overtaken by a later write before a frame showed them,
+ * `dropped' counts writes never shown at all, and the CPU times are
+ * for the whole process, since the file is parsed on a worker
+ * thread.  They include the writer thread.  B is "poll" if the file
+ * is polled, and "native" otherwise.  With --idle=N, the program
+ * keeps watching the unchanged file for N more seconds and I is the
+ * CPU time used during that time, per second.  */
+
+static int rate = 100;
+static int rows = 10;
+static int duration = 10;
+static gboolean rewrite = FALSE;
+static int width = 800;
+static int height = 600;
+static int rate_limit = -1;
+static gboolean poll_flag = FALSE;
+static int idle = 0;
+
+static const gchar *path;
+static int stop = 0;
+static struct state *state;
+
+static struct {
+  GMutex lock;
+  gint64 *time;                 /* start of write i */
+  int used, allocated;
+} writes;
+
+static double *latency;
+static int frames_used, frames_allocated;
+static int last_seen = -1;
+static int coalesced = 0;
+static cairo_surface_t *surface;
+
+
+static void
+write_rows(int fd, GString *buffer, int from, int to)
+/* Write rows `from', ..., `to'-1 and record the time of the write.  */
+{
+  int row;
+
+  g_string_truncate(buffer, 0);
+  for (row=from; row<to; ++row) {
+    g_string_append_printf(buffer, "%d %.6g\n", row, sin(row*.01));
+  }
+
+  g_mutex_lock(&writes.lock);
+  if (writes.used >= writes.allocated) {
+    writes.allocated = writes.allocated ? 2*writes.allocated : 1024;
+    writes.time = g_renew(gint64, writes.time, writes.allocated);
+  }
+  writes.time[writes.used++] = g_get_monotonic_time();
+  g_mutex_unlock(&writes.lock);
+
+  if (write(fd, buffer->str, buffer->len) != (ssize_t)buffer->len) {
+    perror("write");
+    exit(1);
+  }
+}
+
+static gpointer
+writer(gpointer data)
+{
+  gint64 period = G_USEC_PER_SEC / rate;
+  gint64 next = g_get_monotonic_time();
+  GString *buffer = g_string_new(NULL);
+  int n;
+
+  for (n=1; ! g_atomic_int_get(&stop); ++n) {
+    next += period;
+    gint64 now = g_get_monotonic_time();
+    if (next > now) g_usleep(next - now);
+
+    if (rewrite) {
+      int fd = open(path, O_WRONLY|O_TRUNC);
+      write_rows(fd, buffer, 0, (n+1)*rows);
+      close(fd);
+    } else {
+      int fd = open(path, O_WRONLY|O_APPEND);
+      write_rows(fd, buffer, n*rows, (n+1)*rows);
+      close(fd);
+    }
+  }
+
+  g_string_free(buffer, TRUE);
+  return NULL;
+}
+
+static void
+frame_cb(gpointer data)
+{
+  int k;
+
+  if (! state->dataset_used) return;
+
+  struct layout *L = new_layout(width, height,
+                                state->xres, state->yres,
+                                state->min[0], state->max[0],
+                                state->min[1], state->max[1],
+                                state->time_axis);
+  cairo_t *cr = cairo_create(surface);
+  draw_graph(state, cr, L, FALSE);
+  cairo_destroy(cr);
+  cairo_surface_flush(surface);
+  delete_layout(L);
+  gint64 now = g_get_monotonic_time();
+
+  int total = 0;
+  for (k=0; k<state->dataset_used; ++k) total += state->dataset[k].rows;
+  int w = total/rows - 1;
+  if (w <= last_seen) return;
+
+  g_mutex_lock(&writes.lock);
+  gint64 t = writes.time[w];
+  g_mutex_unlock(&writes.lock);
+
+  if (frames_used >= frames_allocated) {
+    frames_allocated = frames_allocated ? 2*frames_allocated : 1024;
+    latency = g_renew(double, latency, frames_allocated);
+  }
+  latency[frames_used++] = now - t;
+  coalesced += w - last_seen - 1;
+  last_seen = w;
+}
+
+static gboolean
+stop_writer(gpointer data)
+{
+  g_atomic_int_set(&stop, 1);
+  return FALSE;
+}
+
+static gboolean
+quit(gpointer data)
+{
+  g_main_loop_quit(data);
+  return FALSE;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double
+percentile(double *sorted, int n, double q)
+{
+  int i = ceil(q*n) - 1;
+  return n ? sorted[CLAMP(i, 0, n-1)] : 0;
+}
+
+static double
+cpu_seconds(struct timeval *tv)
+{
+  return tv->tv_sec + tv->tv_usec * 1e-6;
+}
+
+int
+main(int argc, char **argv)
+{
+  GError *err = NULL;
+
+  GOptionEntry entries[] = {
+    { "rate", 'r', 0, G_OPTION_ARG_INT, &rate,
+      "Write to the file N times per second", "N" },
+    { "rows", 'n', 0, G_OPTION_ARG_INT, &rows,
+      "Write N lines at a time", "N" },
+    { "duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+      "Run the writer for N seconds", "N" },
+    { "rewrite", 0, 0, G_OPTION_ARG_NONE, &rewrite,
+      "Rewrite the whole file instead of appending", NULL },
+    { "width", 0, 0, G_OPTION_ARG_INT, &width,
+      "Width of the image in pixels", "W" },
+    { "height", 0, 0, G_OPTION_ARG_INT, &height,
+      "Height of the image in pixels", "H" },
+    { "rate-limit", 0, 0, G_OPTION_ARG_INT, &rate_limit,
+      "Set the file monitor rate limit to N milliseconds", "N" },
+    { "poll", 0, 0, G_OPTION_ARG_NONE, &poll_flag,
+      "Poll the file instead of using a file monitor", NULL },
+    { "idle", 0, 0, G_OPTION_ARG_INT, &idle,
+      "Measure the CPU use for N seconds without writes", "N" },
+    { NULL, '\0', 0, 0, NULL, NULL, NULL }
+  };
+  GOptionContext *context = g_option_context_new("");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (! g_option_context_parse(context, &argc, &argv, &err)) {
+    fprintf(stderr, "%s\n", err->message);
+    exit(1);
+  }
+  g_option_context_free(context);
+  if (argc != 1 || rate < 1 || rows < 1 || duration < 1 || idle < 0) {
+    fprintf(stderr, "usage: jvqplot-latency [options]\n");
+    exit(1);
+  }
+
+  gchar *tmp_path;
+  int fd = g_file_open_tmp("jvqplot-latency-XXXXXX", &tmp_path, &err);
+  if (fd < 0) {
+    fprintf(stderr, "error: %s\n", err->message);
+    exit(1);
+  }
+  path = tmp_path;
+  GString *buffer = g_string_new(NULL);
+  write_rows(fd, buffer, 0, rows);
+  g_string_free(buffer, TRUE);
+  close(fd);
+
+  state = new_state();
+  surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+
+  GFile *file = g_file_new_for_path(path);
+  add_source(state, file);
+  read_data(state, 0);
+  last_seen = 0;
+  GFileMonitor *monitor = watch_file(state, 0, poll_flag, frame_cb, NULL,
+                                     &err);
+  if (! monitor) {
+    fprintf(stderr, "error: cannot monitor file: %s\n", err->message);
+    exit(1);
+  }
+  if (rate_limit >= 0) g_file_monitor_set_rate_limit(monitor, rate_limit);
+
+  struct rusage ru0, ru1;
+  getrusage(RUSAGE_SELF, &ru0);
+
+  GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+  GThread *thread = g_thread_new("writer", writer, NULL);
+  g_timeout_add_seconds(duration, stop_writer, NULL);
+  /* give the last writes some time to show up */
+  g_timeout_add_seconds(duration+2, quit, loop);
+  g_main_loop_run(loop);
+  g_thread_join(thread);
+
+  getrusage(RUSAGE_SELF, &ru1);
+
+  double cpu_idle = 0;
+  if (idle > 0) {
+    struct rusage ru2;
+    g_timeout_add_seconds(idle, quit, loop);
+    g_main_loop_run(loop);
+    getrusage(RUSAGE_SELF, &ru2);
+    cpu_idle = (cpu_seconds(&ru2.ru_utime) - cpu_seconds(&ru1.ru_utime)
+                + cpu_seconds(&ru2.ru_stime) - cpu_seconds(&ru1.ru_stime))
+      / idle;
+  }
+
+  int n_writes = writes.used;
+  int dropped = n_writes - 1 - last_seen;
+  qsort(latency, frames_used, sizeof(double), compare_double);
+  printf("LATENCY mode=%s monitor=%s rate=%d rows=%d writes=%d frames=%d"
+         " coalesced=%d dropped=%d p50=%.0f p90=%.0f p99=%.0f max=%.0f"
+         " cpu_user=%.3f cpu_sys=%.3f events=%d cpu_idle=%.6f\n",
+         rewrite ? "rewrite" : "append", poll_flag ? "poll" : "native",
+         rate, rows, n_writes, frames_used,
+         coalesced, dropped,
+         percentile(latency, frames_used, .5),
+         percentile(latency, frames_used, .9),
+         percentile(latency, frames_used, .99),
+         percentile(latency, frames_used, 1),
+         cpu_seconds(&ru1.ru_utime) - cpu_seconds(&ru0.ru_utime),
+         cpu_seconds(&ru1.ru_stime) - cpu_seconds(&ru0.ru_stime),
+         state->stats.events, cpu_idle);
+
+  g_object_unref(monitor);
+  g_object_unref(file);
+  delete_state(state);
+  g_unlink(path);
+  g_free(tmp_path);
+  g_main_loop_unref(loop);
+  cairo_surface_destroy(surface);
+  return 0;
+}
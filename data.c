@@ -21,9 +21,13 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <glib.h>
 #include <gio/gio.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 #include "jvqplot.h"
 
@@ -36,61 +40,472 @@ jvqplot_error_quark (void)
 }
 #define JVQPLOT_ERROR_CORRUPTED 1
 #define JVQPLOT_ERROR_INCOMPLETE 2
+#define JVQPLOT_ERROR_REMOVED 3
+
+/* Data sets with more than this many value columns are shown as a
+ * matrix image instead of as separate graphs.  */
+#define MATRIX_COLUMNS 100
+
+
+/* Files are loaded by this many threads at most.  */
+#define MAX_LOAD_THREADS 16
+
+/* Datasets exceeding the memory budget keep at least this many rows.  */
+#define MIN_REDUCED_ROWS 32768
+
+/* Files larger than the memory budget and compressed files are read
+ * in chunks of this size.  When such a file grows, this many bytes
+ * before the old end are compared to check that only data was
+ * appended.  */
+#define STREAM_CHUNK (1<<20)
+#define TAIL_CHECK 4096
+
+/* When a file larger than PREVIEW_MIN_SIZE is opened, a preview is
+ * shown first, using one row from each of a number of evenly spaced
+ * blocks of PREVIEW_BLOCK bytes.  */
+#define PREVIEW_MIN_SIZE (64<<20)
+#define PREVIEW_BLOCK 4096
 
 
-static struct state state_rec = {
-  .dataset_used = 0,
-  .dataset = NULL,
-  .message = NULL,
+struct load {
+  int dataset_used, allocated;
+  struct dataset *dataset;
+  gboolean *borrowed;           /* the data belongs to the old dataset */
+  int *kept;                    /* rows still in the old buffer, see
+                                   append_rows() */
+  int reused;                   /* number of borrowed datasets */
+  struct columns *columns;      /* the columns which were read */
+  gsize tail, tail_skip;        /* see `struct source' */
+  guint64 tail_hash;
+  gboolean preview;             /* only a sample of the rows was read */
+  GError *err;
+  gint64 usec[2];               /* for STAGE_OPEN and STAGE_PARSE */
 };
-struct state *state = &state_rec;
+
+struct load_wait {
+  GMutex lock;
+  GCond done;
+  int pending;
+};
+
+struct load_job {
+  GFile *file;
+  const struct source *prev;
+  struct columns *columns;
+  gsize budget;
+  int samples;                  /* rows per preview, or 0 */
+  gint *progress;
+  struct load *load;
+  struct load_wait *wait;       /* set for read_all() */
+  load_done_func done;          /* set for load_data_async() */
+  gpointer data;
+};
+
+
+/* By default, all columns are shown.  */
+static const struct columns all_columns = { 0, NULL, FALSE };
 
 
+struct state *
+new_state(void)
+{
+  struct state *state = g_new0(struct state, 1);
+  state->xres = state->yres = 96;
+  return state;
+}
+
+static void
+free_dataset(struct dataset *ds)
+{
+  g_free(ds->data);
+  g_free(ds->offset);
+  free_reduction(ds->reduction);
+  if (ds->names) g_bytes_unref(ds->names);
+}
+
 static void
-update_message(const gchar *message)
+free_datasets(int dataset_used, struct dataset *dataset)
 {
+  int k;
+
+  for (k=0; k<dataset_used; ++k) free_dataset(&dataset[k]);
+  g_free(dataset);
+}
+
+static void
+free_ghost(struct ghost *g)
+{
+  g_free(g->color);
+  g_free(g->data);
+}
+
+static struct columns *
+copy_columns(const struct columns *sel)
+{
+  struct columns *copy = g_new(struct columns, 1);
+
+  copy->len = sel->len;
+  copy->hidden = g_memdup(sel->hidden, sel->len * sizeof(gboolean));
+  copy->hide_rest = sel->hide_rest;
+  return copy;
+}
+
+static void
+free_columns(struct columns *sel)
+{
+  if (! sel) return;
+  g_free(sel->hidden);
+  g_free(sel);
+}
+
+void
+delete_state(struct state *state)
+{
+  int s;
+
+  for (s=0; s<state->source_used; ++s) {
+    struct source *src = &state->source[s];
+    if (src->file) g_object_unref(src->file);
+    free_datasets(src->dataset_used, src->dataset);
+    free_columns(src->columns);
+    g_free(src->message);
+  }
+  g_free(state->source);
+  g_free(state->columns.hidden);
+  g_free(state->dataset);     /* the data is owned by the sources */
   g_free(state->message);
-  if (message && *message) {
-    state->message = g_strdup(message);
-  } else {
-    state->message = NULL;
+  for (s=0; s<state->ghost_used; ++s) free_ghost(&state->ghost[s]);
+  g_free(state->ghost);
+  if (state->density_cache) delete_density_cache(state->density_cache);
+  if (state->matrix_cache) delete_matrix_cache(state->matrix_cache);
+  if (state->layer_cache) delete_layer_cache(state->layer_cache);
+  g_free(state);
+}
+
+int
+add_source(struct state *state, GFile *file)
+{
+  int s = state->source_used++;
+
+  state->source = g_renew(struct source, state->source, state->source_used);
+  memset(&state->source[s], 0, sizeof(struct source));
+  state->source[s].file = g_object_ref(file);
+  state->source[s].progress = -1;
+  return s;
+}
+
+
+gboolean
+column_hidden(const struct columns *sel, int c)
+{
+  if (c == 0) return FALSE;     /* the x-values are always read */
+  return c < sel->len ? sel->hidden[c] : sel->hide_rest;
+}
+
+void
+set_column_hidden(struct columns *sel, int c, gboolean hidden)
+{
+  int i;
+
+  if (c >= sel->len) {
+    sel->hidden = g_renew(gboolean, sel->hidden, c+1);
+    for (i=sel->len; i<=c; ++i) sel->hidden[i] = sel->hide_rest;
+    sel->len = c+1;
   }
+  sel->hidden[c] = hidden;
 }
 
+gboolean
+parse_columns(struct columns *sel, const gchar *spec, GError **err)
+/* `spec' is a comma separated list of column numbers or ranges, like
+ * "2,5-7", counting from 1.  Only the listed columns are shown.  */
+{
+  gchar **part = g_strsplit(spec, ",", 0);
+  gboolean ok = TRUE;
+  int i, c;
+
+  g_free(sel->hidden);
+  sel->hidden = NULL;
+  sel->len = 0;
+  sel->hide_rest = TRUE;
+  for (i=0; part[i] && ok; ++i) {
+    char *end;
+    long a = strtol(part[i], &end, 10);
+    long b = a;
+    if (*end == '-') b = strtol(end+1, &end, 10);
+    if (*end || end == part[i] || a < 1 || b < a || b > G_MAXINT/2) {
+      g_set_error(err, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                  "invalid column list \"%s\"", spec);
+      ok = FALSE;
+      break;
+    }
+    for (c=a; c<=b; ++c) set_column_hidden(sel, c-1, FALSE);
+  }
+  g_strfreev(part);
+  return ok;
+}
+
+const gchar *
+column_name(const struct dataset *ds, int j)
+{
+  if (! ds->names) return NULL;
+
+  int c = ds->file_cols == 1 ? 0 : dataset_column(ds, j);
+  gsize size;
+  const gchar *name = g_bytes_get_data(ds->names, &size);
+  const gchar *end = name + size;
+  while (c-- > 0 && name < end) name += strlen(name) + 1;
+  return (name < end && *name) ? name : NULL;
+}
+
+int
+dataset_column(const struct dataset *ds, int j)
+{
+  int c;
+
+  if (ds->file_cols == 1 || ! ds->columns) return j;
+  for (c=1; c<ds->file_cols; ++c) {
+    if (! column_hidden(ds->columns, c) && --j == 0) return c;
+  }
+  return c;
+}
+
+
 static void
-update_data(int dataset_used, struct dataset *dataset)
+update_message(struct state *state)
+/* Collect the messages of all sources.  */
 {
-  int  i, j, k;
+  GString *message = g_string_new(NULL);
+  int s;
 
-  if (dataset_used == 0) return;
+  for (s=0; s<state->source_used; ++s) {
+    struct source *src = &state->source[s];
+    gboolean has_message = src->message && *src->message;
+    if (! has_message && src->progress < 0) continue;
+    if (message->len) g_string_append(message, "; ");
+    if (state->source_used > 1) {
+      gchar *name = g_file_get_basename(src->file);
+      g_string_append_printf(message, "%s: ", name);
+      g_free(name);
+    }
+    if (has_message) g_string_append(message, src->message);
+    if (src->progress >= 0) {
+      g_string_append_printf(message, "%sloading, %d%%",
+                             has_message ? ", " : "", src->progress/10);
+    }
+  }
 
-  for (k=0; k<state->dataset_used; ++k) g_free(state->dataset[k].data);
-  g_free(state->dataset);
-  state->dataset_used = dataset_used;
-  state->dataset = dataset;
+  g_free(state->message);
+  state->message = g_string_free(message, message->len == 0);
+}
 
-  for (j=0; j<2; ++j) {
-    state->min[j] = state->max[j] = dataset[0].data[j];
+const double *
+ghost_data(struct state *state, const struct ghost *g)
+{
+  if (g->data) return g->data;
+  return state->source[g->source].dataset[g->dataset].data;
+}
+
+static void
+add_ghosts(struct state *state, int s, int dataset_used,
+           struct dataset *dataset, gboolean keep)
+/* The datasets of source `s' are about to be replaced by `dataset'.
+ * Ghosts whose rows change get a copy of them.  If `keep' is set, the
+ * current datasets are added as ghosts and ghosts which are too old
+ * are removed.  */
+{
+  struct source *src = &state->source[s];
+  int first = 0;
+  int i, j, k, n;
+
+  gboolean changed = dataset_used != src->dataset_used;
+  for (k=0; k<src->dataset_used && ! changed; ++k) {
+    changed = dataset[k].data != src->dataset[k].data
+      || dataset[k].rows != src->dataset[k].rows;
   }
+  if (! changed) return;
+
+  for (i=0, n=0; i<state->ghost_used; ++i) {
+    struct ghost *g = &state->ghost[i];
+    if (g->source == s) {
+      if (keep) g->age += 1;
+      if (g->age > state->history) {
+        free_ghost(g);
+        continue;
+      }
+      k = g->dataset;
+      if (! g->data
+          && (k >= dataset_used || dataset[k].cols != g->cols
+              || dataset[k].stable_rows < g->rows)) {
+        g->data = g_memdup(src->dataset[k].data,
+                           (gsize)g->rows*g->cols*sizeof(double));
+      }
+    }
+    state->ghost[n++] = *g;
+  }
+  state->ghost_used = n;
+  if (! keep) return;
+
+  for (i=0; i<s; ++i) first += state->source[i].dataset_used;
+  for (k=0; k<src->dataset_used; ++k) {
+    struct dataset *old = &src->dataset[k];
+    if (k < dataset_used && dataset[k].data == old->data
+        && dataset[k].rows == old->rows)
+      continue;
+
+    state->ghost = g_renew(struct ghost, state->ghost, state->ghost_used+1);
+    struct ghost *g = &state->ghost[state->ghost_used++];
+    g->source = s;
+    g->dataset = k;
+    g->age = 1;
+    g->rows = old->rows;
+    g->cols = old->cols;
+    g->color = g_new(int, old->cols);
+    for (j=1; j<old->cols; ++j) {
+      const struct dataset *ds = &state->dataset[first+k];
+      g->color[j] = (ds->color + dataset_column(ds, j)-1)%100;
+    }
+    g->data = NULL;
+    if (k >= dataset_used || dataset[k].cols != old->cols
+        || dataset[k].stable_rows < old->rows) {
+      if (k < dataset_used && dataset[k].data == old->data) {
+        g->data = g_memdup(old->data,
+                           (gsize)old->rows*old->cols*sizeof(double));
+      } else {
+        /* the buffer would be freed below, the ghost takes it over */
+        g->data = old->data;
+        old->data = NULL;
+      }
+    }
+    for (j=0; j<2; ++j) {
+      g->min[j] = old->min[j];
+      g->max[j] = old->max[j];
+    }
+  }
+}
+
+static void
+update_source(struct state *state, int s,
+              int dataset_used, struct dataset *dataset, gboolean keep)
+/* Replace the datasets of source `s', keeping the old ones as ghosts
+ * if `keep' is set.  */
+{
+  struct source *src = &state->source[s];
+  int k;
+
+  /* find the datasets which only had rows appended, where
+   * load_data() could not tell from the bytes */
   for (k=0; k<dataset_used; ++k) {
-    int rows = dataset[k].rows;
-    int cols = dataset[k].cols;
-    double *data = dataset[k].data;
-    for (i=0; i<rows; ++i) {
-      for (j=0; j<cols; ++j) {
-        double x = data[i*cols+j];
-        int jj = j>1 ? 1 : j;
-        if (x < state->min[jj]) state->min[jj] = x;
-        if (x > state->max[jj]) state->max[jj] = x;
+    if (dataset[k].stable_rows > 0 || k >= src->dataset_used) continue;
+    struct dataset *old = &src->dataset[k];
+    if (old->cols == dataset[k].cols && old->rows <= dataset[k].rows
+        && memcmp(old->data, dataset[k].data,
+                  old->rows*old->cols*sizeof(double)) == 0) {
+      dataset[k].stable_rows = old->rows;
+    }
+  }
+
+  if (state->ghost_used || (keep && state->history > 0))
+    add_ghosts(state, s, dataset_used, dataset, keep);
+
+  /* unchanged datasets keep their buffers */
+  for (k=0; k<src->dataset_used; ++k) {
+    if (k < dataset_used && dataset[k].data == src->dataset[k].data)
+      continue;
+    free_dataset(&src->dataset[k]);
+  }
+  g_free(src->dataset);
+  src->dataset_used = dataset_used;
+  src->dataset = dataset;
+}
+
+static void
+merge_sources(struct state *state, int changed, gboolean shifted)
+/* Collect the datasets of all sources in `state->dataset'.  Source
+ * `changed' has new data, if `shifted' is set, the number of its
+ * datasets has changed, too.  */
+{
+  int  j, k, s;
+
+  int dataset_used = 0;
+  for (s=0; s<state->source_used; ++s) {
+    dataset_used += state->source[s].dataset_used;
+  }
+  state->dataset = g_renew(struct dataset, state->dataset,
+                           MAX(dataset_used, 1));
+  state->dataset_used = dataset_used;
+  state->generation += 1;
+  state->reduced = FALSE;
+  state->time_axis = state->time_x;
+
+  /* every file gets its own range of colours */
+  struct dataset *dataset = state->dataset;
+  int color = 0;
+  int n = 0;
+  for (s=0; s<state->source_used; ++s) {
+    struct source *src = &state->source[s];
+    int max_cols = 0;
+    for (k=0; k<src->dataset_used; ++k) {
+      dataset[n] = src->dataset[k];
+      dataset[n].color = color;
+      dataset[n].columns = src->columns;
+      if (dataset[n].reduction) state->reduced = TRUE;
+      if (dataset[n].time) state->time_axis = TRUE;
+      if (s > changed && shifted) {
+        dataset[n].stable_rows = 0;
+      } else if (s != changed) {
+        dataset[n].stable_rows = dataset[n].rows;
       }
+      /* hiding a column doesn't change the colours of the others */
+      int file_cols = MAX(dataset[n].file_cols, 2);
+      if (file_cols > max_cols) max_cols = file_cols;
+      n += 1;
     }
+    color += MAX(max_cols-1, 0);
+  }
+  if (dataset_used == 0) return;
+
+  /* the ranges of the datasets are found while parsing, datasets
+   * with all value columns hidden don't have a y-range */
+  state->min[0] = state->min[1] = G_MAXDOUBLE;
+  state->max[0] = state->max[1] = -G_MAXDOUBLE;
+  int max_cols = 0;
+  for (k=0; k<dataset_used; ++k) {
+    if (dataset[k].cols > max_cols) max_cols = dataset[k].cols;
+    for (j=0; j<2; ++j) {
+      if (j == 1 && dataset[k].cols < 2) break;
+      if (dataset[k].min[j] < state->min[j]) state->min[j] = dataset[k].min[j];
+      if (dataset[k].max[j] > state->max[j]) state->max[j] = dataset[k].max[j];
+    }
+  }
+  /* ghosts stay in view, except for matrices, where they are not shown */
+  for (k=0; k<state->ghost_used && max_cols-1 <= MATRIX_COLUMNS; ++k) {
+    struct ghost *g = &state->ghost[k];
+    for (j=0; j<2; ++j) {
+      if (j == 1 && g->cols < 2) break;
+      if (g->min[j] < state->min[j]) state->min[j] = g->min[j];
+      if (g->max[j] > state->max[j]) state->max[j] = g->max[j];
+    }
+  }
+  if (state->min[1] > state->max[1]) state->min[1] = state->max[1] = 0;
+
+  /* in matrix mode, the vertical axis shows the column index and the
+   * data values are mapped to colours */
+  state->matrix = max_cols-1 > MATRIX_COLUMNS;
+  if (state->matrix) {
+    state->zmin = state->min[1];
+    state->zmax = state->max[1];
+    state->min[1] = .5;
+    state->max[1] = max_cols - .5;
   }
 
   for (j=0; j<2; ++j) {
+    if (j == 1 && state->matrix) break;
     if (state->min[j] == state->max[j]) {
       state->min[j] -= 1;
       state->max[j] += 1;
     }
+    if (j == 0 && state->time_axis) continue;
     if (state->min[j] > 0 && 4*state->min[j] <= state->max[j]) {
       /* at most extend the horizontal range by anoth 33.3% */
       state->min[j] = 0;
@@ -100,136 +515,1238 @@ update_data(int dataset_used, struct dataset *dataset)
       state->max[j] = 0;
     }
   }
+}
+
+static guint64
+hash_bytes(guint64 h, const gchar *p, gsize n)
+/* 64 bit FNV-1a, continuing from `h'.  */
+{
+  const guchar *q = (const guchar *)p;
+  gsize i;
+
+  for (i=0; i<n; ++i) {
+    h ^= q[i];
+    h *= G_GUINT64_CONSTANT(0x100000001b3);
+  }
+  return h;
+}
+#define HASH_INIT G_GUINT64_CONSTANT(0xcbf29ce484222325)
+
+static void
+set_progress(gint *progress, double fraction)
+{
+  if (progress) g_atomic_int_set(progress, CLAMP(1000*fraction, 0, 1000));
+}
+
+static gchar *
+read_contents(GInputStream *in, goffset size, gsize *len, gint *progress,
+              GError **err)
+/* Read the whole stream into one buffer, allocated for `size' bytes
+ * and only grown if the file grew since.  Reading counts as the
+ * first quarter of the progress.  */
+{
+  gsize allocated = (size > 0 ? (gsize)size : STREAM_CHUNK) + 1;
+  gchar *buf = g_malloc(allocated);
+  gsize used = 0;
+
+  for (;;) {
+    if (used == allocated) {
+      allocated *= 2;
+      buf = g_realloc(buf, allocated);
+    }
+    gsize want = MIN(allocated - used, STREAM_CHUNK);
+    gsize n;
+    if (! g_input_stream_read_all(in, buf + used, want, &n, NULL, err)) {
+      g_free(buf);
+      return NULL;
+    }
+    used += n;
+    if (n < want) break;
+    if (size > 0) set_progress(progress, .25*used/size);
+  }
+  *len = used;
+  return buf;
+}
+
+static int
+stored_cols(int file_cols, const struct columns *sel)
+/* Number of columns kept in memory: x and the shown value columns.  */
+{
+  int n = 1;
+  int c;
+
+  if (file_cols == 1) return 2;
+  for (c=1; c<file_cols; ++c) {
+    if (! column_hidden(sel, c)) n += 1;
+  }
+  return n;
+}
+
+static gboolean
+same_columns(int file_cols, const struct columns *a, const struct columns *b)
+{
+  int c;
+
+  if (file_cols == 1) return TRUE;
+  for (c=1; c<file_cols; ++c) {
+    if (column_hidden(a, c) != column_hidden(b, c)) return FALSE;
+  }
+  return TRUE;
+}
+
+static gchar
+find_delimiter(const gchar *line, gsize n)
+/* Fields are separated by semicolons or commas, if the first line of
+ * a dataset contains any, and by single spaces or tabs otherwise.  */
+{
+  if (memchr(line, ';', n)) return ';';
+  if (memchr(line, ',', n)) return ',';
+  return ' ';
+}
+
+static inline gboolean
+is_separator(gchar c, gchar delim)
+{
+  return delim == ' ' ? (c == ' ' || c == '\t') : c == delim;
+}
+
+static int
+count_fields(const gchar *line, gsize n, gchar delim)
+/* Where SSE2 is available, the separators are counted 32 bytes at a
+ * time, using a bit mask of the matching bytes.  */
+{
+  gchar d1 = delim;
+  gchar d2 = delim == ' ' ? '\t' : delim;
+  int cols = 1;
+  gsize i = 0;
+
+#ifdef __SSE2__
+  const __m128i v1 = _mm_set1_epi8(d1);
+  const __m128i v2 = _mm_set1_epi8(d2);
+  for (; i+32 <= n; i+=32) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(line+i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(line+i+16));
+    __m128i ma = _mm_or_si128(_mm_cmpeq_epi8(a, v1), _mm_cmpeq_epi8(a, v2));
+    __m128i mb = _mm_or_si128(_mm_cmpeq_epi8(b, v1), _mm_cmpeq_epi8(b, v2));
+    guint32 bits = (guint32)_mm_movemask_epi8(ma)
+      | (guint32)_mm_movemask_epi8(mb) << 16;
+    cols += __builtin_popcount(bits);
+  }
+#endif
+  for (; i<n; ++i) cols += line[i] == d1 || line[i] == d2;
+  return cols;
+}
 
-  update_message(NULL);
+static void
+trim_field(const gchar **word, const gchar **word_end, gchar delim)
+/* In comma and semicolon separated files, fields may be padded.  */
+{
+  if (delim == ' ') return;
+  while (*word < *word_end && (**word == ' ' || **word == '\t')) ++*word;
+  while (*word_end > *word && ((*word_end)[-1] == ' '
+                               || (*word_end)[-1] == '\t'))
+    --*word_end;
+}
+
+static gboolean
+parse_number(const gchar *word, gsize len, double *x)
+{
+  char small[64];
+  char *copy = len < sizeof(small) ? small : g_malloc(len+1);
+  memcpy(copy, word, len);
+  copy[len] = '\0';
+  char *endptr;
+  *x = strtod(copy, &endptr);
+  gboolean ok = ! *endptr;
+  if (copy != small) g_free(copy);
+  return ok;
+}
+
+static GBytes *
+header_names(const gchar *line, gsize n, gchar delim, int *cols)
+/* If some field of the line is not a number, the line is a header
+ * and the field names are returned, separated by NUL bytes, and the
+ * number of names is stored in `*cols'.  Names may be quoted, to
+ * include the separator.  For data rows, NULL is returned.  */
+{
+  const gchar *line_end = line + n;
+  const gchar *word = line;
+  gboolean header = FALSE;
+  GString *names = g_string_new(NULL);
+  int c;
+
+  for (c=0; word <= line_end; ++c) {
+    const gchar *word_end = word;
+    while (word_end < line_end && (*word_end == ' ' || *word_end == '\t')
+           && delim != ' ')
+      ++word_end;
+    if (word_end < line_end && *word_end == '"') {
+      const gchar *quote = memchr(word_end+1, '"', line_end - word_end - 1);
+      if (quote) word_end = quote;
+    }
+    while (word_end < line_end && ! is_separator(*word_end, delim))
+      ++word_end;
+    const gchar *a = word;
+    const gchar *b = word_end;
+    trim_field(&a, &b, delim);
+
+    double x;
+    if (! (c == 0 && is_timestamp(a, b-a)) && ! parse_number(a, b-a, &x))
+      header = TRUE;
+    if (b-a >= 2 && *a == '"' && b[-1] == '"') ++a, --b;
+    g_string_append_len(names, a, b-a);
+    g_string_append_c(names, '\0');
+    word = word_end + 1;
+  }
+  if (! header) {
+    g_string_free(names, TRUE);
+    return NULL;
+  }
+  *cols = c;
+  return g_string_free_to_bytes(names);
 }
 
-static double *
-parse_data_file(GDataInputStream *in,
-                int *rows_ret, int *cols_ret, GError **err_ret)
+struct parse {
+  const gchar *buf;
+  gsize len;
+  gsize pos;                    /* start of the next line */
+  gsize start;                  /* start of the current dataset */
+  gsize rows_end;               /* end of the last data row */
+  int allocated;                /* rows allocated for the current dataset */
+  gboolean borrowed;            /* the data belongs to the old dataset */
+  int kept;                     /* rows left in the buffer of the old
+                                   dataset, which `ds->data' follows */
+  gboolean ended;               /* an empty line ended the dataset */
+  gboolean streaming;           /* `buf' is a window of the file */
+  const struct columns *sel;    /* the columns to read */
+  gsize budget;                 /* bytes available for all datasets */
+  gsize used;                   /* bytes used by the finished datasets */
+  gint *progress;               /* see parse_rows() */
+};
+
+static int
+max_rows(struct parse *p, struct dataset *ds, gboolean indexed)
+/* The number of rows of `ds' which fit into the budget, or 0.  */
 {
-  GError *err = NULL;
-  int result_used = 0;
-  int result_allocated = 256;
-  double *result = g_new(double, result_allocated);
+  gsize row_bytes = ds->cols*sizeof(double) + (indexed ? sizeof(gsize) : 0);
 
-  gchar *line;
-  int rows = 0;
-  int cols = 0;
+  if (! p->budget) return 0;
+  gsize rows = p->budget > p->used ? (p->budget - p->used) / row_bytes : 0;
+  return CLAMP(rows, MIN_REDUCED_ROWS, G_MAXINT/2);
+}
 
-  while ((line = g_data_input_stream_read_line(in, NULL, NULL, &err))) {
-    gchar **words = g_strsplit_set(line, " \t", 0);
-    gboolean is_empty = ! words[0];
-    if (is_empty || words[0][0] == '#') goto next_line;
+static void
+parse_rows(struct parse *p, struct dataset *ds, GError **err)
+/* Read lines starting at `p->pos' and append them to `ds', until an
+ * empty line ends the dataset or the input is used up.  Hidden
+ * columns are skipped without converting them, instead the offset of
+ * every row is recorded so that they can be read later.  */
+{
+  while (p->pos < p->len) {
+    const gchar *line = p->buf + p->pos;
+    const gchar *nl = memchr(line, '\n', p->len - p->pos);
+    gsize n = nl ? (gsize)(nl - line) : p->len - p->pos;
+    gsize next = p->pos + n + (nl ? 1 : 0);
+    if (n > 0 && line[n-1] == '\r') n -= 1;
 
-    int n = 0;
-    while (words[n]) ++n;
-    if (cols == 0) {
-      cols = n;
-    } else if (n < cols
-               && g_buffered_input_stream_get_available(G_BUFFERED_INPUT_STREAM(in)) == 0) {
-      g_set_error(&err, JVQPLOT_ERROR, JVQPLOT_ERROR_INCOMPLETE,
+    if (n == 0) {
+      p->pos = next;
+      if (ds->rows > 0) {
+        p->ended = TRUE;
+        return;
+      }
+      continue;
+    }
+    if (line[0] == '#') {
+      p->pos = next;
+      continue;
+    }
+
+    if (! ds->delim) ds->delim = find_delimiter(line, n);
+    gchar delim = ds->delim;
+    int cols = count_fields(line, n, delim);
+    if (ds->file_cols == 0) {
+      ds->names = header_names(line, n, delim, &cols);
+      ds->file_cols = cols;
+      ds->cols = stored_cols(cols, p->sel);
+      if (ds->names) {
+        p->pos = next;
+        continue;
+      }
+    } else if (cols < ds->file_cols && next >= p->len && ! p->streaming) {
+      g_set_error(err, JVQPLOT_ERROR, JVQPLOT_ERROR_INCOMPLETE,
                   "incomplete input");
-      goto next_line;
-    } else if (cols != n) {
-      g_set_error(&err, JVQPLOT_ERROR, JVQPLOT_ERROR_CORRUPTED,
+      p->pos = next;
+      return;
+    } else if (cols != ds->file_cols) {
+      g_set_error(err, JVQPLOT_ERROR, JVQPLOT_ERROR_CORRUPTED,
                   "invalid data (malformed matrix)");
-      goto next_line;
+      return;
+    }
+    gboolean indexed = ds->cols < MAX(cols, 2)
+      && ! p->streaming && ! ds->reduction;
+    int limit = max_rows(p, ds, indexed);
+
+    /* reduced datasets need room for four rows at the end */
+    if (p->borrowed && ! limit && ! ds->reduction) {
+      /* collect the appended rows in a buffer of their own, the old
+       * rows are moved there by install_data() */
+      p->kept = ds->rows;
+      p->allocated = 0;
+      ds->data = NULL;
+      ds->offset = NULL;
+      if (p->streaming) ds->length = 0;
+      p->borrowed = FALSE;
+    } else if (p->borrowed) {
+      /* copy on write */
+      p->allocated = MAX(2*ds->rows, 256);
+      if (limit) p->allocated = MAX(MIN(p->allocated, limit+5), ds->rows+4);
+      double *data = g_new(double, p->allocated*ds->cols);
+      memcpy(data, ds->data, ds->rows*ds->cols*sizeof(double));
+      ds->data = data;
+      if (indexed) {
+        gsize *offset = g_new(gsize, p->allocated);
+        memcpy(offset, ds->offset, ds->rows*sizeof(gsize));
+        ds->offset = offset;
+      }
+      if (ds->reduction) ds->reduction = copy_reduction(ds->reduction);
+      if (ds->names) g_bytes_ref(ds->names);
+      /* appended rows are not hashed while streaming */
+      if (p->streaming) ds->length = 0;
+      p->borrowed = FALSE;
+    }
+    if (ds->rows-p->kept+4 > p->allocated) {
+      p->allocated = MAX(2*p->allocated, 256);
+      if (limit) p->allocated = MAX(MIN(p->allocated, limit+5), ds->rows+4);
+      ds->data = g_renew(double, ds->data, p->allocated*ds->cols);
+      if (indexed) ds->offset = g_renew(gsize, ds->offset, p->allocated);
+    }
+
+    if (ds->rows == 0 && cols > 1) {
+      const gchar *sep = line;
+      while (! is_separator(*sep, delim)) ++sep;
+      const gchar *first = line;
+      trim_field(&first, &sep, delim);
+      ds->time = is_timestamp(first, sep - first);
     }
 
     /* if there is only one column, prepend the index */
-    if (cols == 1) {
-      if (result_used >= result_allocated) {
-        result_allocated *= 2;
-        result = g_renew(double, result, result_allocated);
+    double *row = ds->data + (ds->rows-p->kept)*ds->cols;
+    int j = 0;
+    int c = 0;
+    if (cols == 1) row[j++] = rows_read(ds)+1;
+    const gchar *word = line;
+    const gchar *line_end = line + n;
+    while (word <= line_end) {
+      const gchar *word_end = word;
+      while (word_end < line_end && ! is_separator(*word_end, delim))
+        ++word_end;
+      const gchar *next_word = word_end + 1;
+      trim_field(&word, &word_end, delim);
+
+      if (c == 0 && ds->time) {
+        if (! parse_timestamp(word, word_end - word, &row[j++])) {
+          g_set_error(err, JVQPLOT_ERROR, JVQPLOT_ERROR_CORRUPTED,
+                      "invalid data (malformed time)");
+          return;
+        }
+      } else if (cols == 1 || ! column_hidden(p->sel, c)) {
+        if (! parse_number(word, word_end - word, &row[j++])) {
+          g_set_error(err, JVQPLOT_ERROR, JVQPLOT_ERROR_CORRUPTED,
+                      "invalid data (malformed number)");
+          return;
+        }
       }
-      result[result_used++] = rows+1;
+      c += 1;
+      word = next_word;
     }
+    if (indexed) ds->offset[ds->rows-p->kept] = p->pos - p->start;
 
-    int i;
-    for (i=0; i<cols; ++i) {
-      char *endptr;
-      double x = strtod(words[i], &endptr);
-      if (*endptr) {
-        g_set_error(&err, JVQPLOT_ERROR, JVQPLOT_ERROR_CORRUPTED,
-                    "invalid data (malformed number)");
-        goto next_line;
+    if (ds->rows == 0) {
+      ds->min[0] = ds->max[0] = row[0];
+      ds->min[1] = ds->max[1] = ds->cols > 1 ? row[1] : 0;
+    }
+    for (j=0; j<ds->cols; ++j) {
+      int jj = j>1 ? 1 : j;
+      if (row[j] < ds->min[jj]) ds->min[jj] = row[j];
+      if (row[j] > ds->max[jj]) ds->max[jj] = row[j];
+    }
+    if (ds->reduction) {
+      reduce_add(ds);
+    } else {
+      ds->rows += 1;
+      if (limit && ds->rows > limit) reduce_start(ds, limit);
+    }
+    ds->ends_line = nl != NULL;
+    p->rows_end = next;
+    p->pos = next;
+
+    /* the remaining three quarters of the progress, after reading */
+    if (p->progress && ds->rows % 65536 == 0) {
+      set_progress(p->progress, .25 + .75*p->pos/p->len);
+    }
+  }
+}
+
+static gsize *
+index_rows(struct parse *p, int rows, gboolean header)
+/* Find the offsets of the first `rows' data rows at `p->pos'.  If
+ * `header' is set, the first line which is not a comment holds the
+ * column names and is skipped.  */
+{
+  gsize *offset = g_new(gsize, rows);
+  gsize pos = p->pos;
+  int i = 0;
+
+  while (i < rows && pos < p->len) {
+    const gchar *line = p->buf + pos;
+    const gchar *nl = memchr(line, '\n', p->len - pos);
+    if (*line != '\n' && *line != '\r' && *line != '#') {
+      if (header) {
+        header = FALSE;
+      } else {
+        offset[i++] = pos - p->pos;
       }
-      if (result_used >= result_allocated) {
-        result_allocated *= 2;
-        result = g_renew(double, result, result_allocated);
+    }
+    if (! nl) break;
+    pos += nl - line + 1;
+  }
+  return offset;
+}
+
+static gboolean
+reproject(struct parse *p, const struct dataset *old,
+          const struct columns *old_sel, struct dataset *ds, GError **err)
+/* Build `ds' from `old', which was read from the same bytes, but with
+ * the columns `old_sel'.  Columns read before are copied, the others
+ * are converted by jumping to the start of every row.  */
+{
+  int fc = old->file_cols;
+  int *from = g_new(int, fc);   /* the column in `old', or -1 */
+  int *pick = g_new(int, fc);   /* the file column of each column */
+  gboolean ok = TRUE;
+  int i, j, c, m;
+
+  *ds = *old;
+  ds->cols = stored_cols(fc, p->sel);
+  ds->stable_rows = 0;
+  if (ds->names) g_bytes_ref(ds->names);
+  for (c=0, m=0; c<fc; ++c) from[c] = column_hidden(old_sel, c) ? -1 : m++;
+  for (c=0, j=0; c<fc; ++c) {
+    if (! column_hidden(p->sel, c)) pick[j++] = c;
+  }
+
+  gsize *offset = old->offset;
+  if (! offset) offset = index_rows(p, old->rows, old->names != NULL);
+  ds->data = g_new(double, old->rows*ds->cols);
+  for (i=0; i<old->rows && ok; ++i) {
+    const gchar *word = p->buf + p->pos + offset[i];
+    const gchar *end = p->buf + p->len;
+    double *row = ds->data + i*ds->cols;
+    int field = 0;
+    for (j=0; j<ds->cols; ++j) {
+      c = pick[j];
+      if (from[c] >= 0) {
+        row[j] = old->data[i*old->cols + from[c]];
+        continue;
+      }
+      while (field < c) {
+        while (! is_separator(*word, old->delim)) ++word;
+        ++word;
+        ++field;
+      }
+      const gchar *word_end = word;
+      while (word_end < end && ! is_separator(*word_end, old->delim)
+             && *word_end != '\n')
+        ++word_end;
+      if (word_end > word && word_end[-1] == '\r'
+          && (word_end == end || *word_end == '\n'))
+        --word_end;
+      const gchar *a = word;
+      trim_field(&a, &word_end, old->delim);
+      if (! parse_number(a, word_end - a, &row[j])) {
+        g_set_error(err, JVQPLOT_ERROR, JVQPLOT_ERROR_CORRUPTED,
+                    "invalid data (malformed number)");
+        ok = FALSE;
+        break;
       }
-      result[result_used++] = x;
     }
-    rows += 1;
+    if (! ok) break;
 
-  next_line:
-    g_strfreev(words);
-    g_free(line);
-    if (err) break;
-    if (is_empty && rows > 0) break;
+    if (i == 0) {
+      ds->min[1] = ds->max[1] = ds->cols > 1 ? row[1] : 0;
+    }
+    for (j=1; j<ds->cols; ++j) {
+      if (row[j] < ds->min[1]) ds->min[1] = row[j];
+      if (row[j] > ds->max[1]) ds->max[1] = row[j];
+    }
   }
 
-  if (err) {
-    g_propagate_error(err_ret, err);
-    if (g_error_matches(err, JVQPLOT_ERROR, JVQPLOT_ERROR_CORRUPTED)) {
-      g_free(result);
-      return NULL;
+  ds->offset = NULL;
+  if (ok && ds->cols < MAX(fc, 2)) {
+    ds->offset = (offset == old->offset)
+      ? g_memdup(offset, old->rows*sizeof(gsize)) : offset;
+  } else if (offset != old->offset) {
+    g_free(offset);
+  }
+  if (! ok) {
+    g_free(ds->data);
+    ds->data = NULL;
+  }
+  g_free(pick);
+  g_free(from);
+  return ok;
+}
+
+gsize
+dataset_bytes(struct dataset *ds)
+{
+  gsize bytes = (gsize)ds->rows * ds->cols * sizeof(double);
+  if (ds->offset) bytes += (gsize)ds->rows * sizeof(gsize);
+  return bytes;
+}
+
+static gboolean
+can_reuse(struct parse *p, const struct dataset *old)
+/* Check whether the input at `p->pos' starts with the bytes `old' was
+ * read from.  */
+{
+  gsize end = p->pos + old->length;
+
+  if (old->length == 0 || end > p->len) return FALSE;
+  /* if the last row had no newline, more data may continue it */
+  if (! old->ends_line && end < p->len) return FALSE;
+  return hash_bytes(HASH_INIT, p->buf + p->pos, old->length) == old->hash;
+}
+
+static void
+add_dataset(struct load *load, const struct dataset *ds, gboolean borrowed,
+            int kept)
+{
+  int k = load->dataset_used++;
+
+  if (k >= load->allocated) {
+    load->allocated = MAX(2*load->allocated, 4);
+    load->dataset = g_renew(struct dataset, load->dataset, load->allocated);
+    load->borrowed = g_renew(gboolean, load->borrowed, load->allocated);
+    load->kept = g_renew(int, load->kept, load->allocated);
+  }
+  load->dataset[k] = *ds;
+  load->borrowed[k] = borrowed;
+  load->kept[k] = kept;
+  if (borrowed) load->reused += 1;
+}
+
+static void
+discard_dataset(struct dataset *ds, int kept)
+/* Free a dataset read by parse_rows() which is not used.  If rows
+ * were appended to an old dataset, everything but the new rows
+ * belongs to that.  */
+{
+  if (kept) {
+    g_free(ds->data);
+    g_free(ds->offset);
+  } else {
+    free_dataset(ds);
+  }
+}
+
+static void
+finish_dataset(struct parse *p, struct dataset *ds)
+/* Release the unused memory of a dataset read by parse_rows().  */
+{
+  int rows = ds->rows - p->kept;
+
+  if (p->borrowed) return;
+  if (ds->reduction) reduce_finish(ds);
+  ds->data = g_renew(double, ds->data, rows*ds->cols);
+  if (ds->offset) ds->offset = g_renew(gsize, ds->offset, rows);
+  p->used += dataset_bytes(ds);
+}
+
+static void
+split_datasets(struct load *load, const gchar *buf, gsize len,
+               const struct source *prev, gsize budget, gint *progress)
+{
+  struct parse p;
+  const struct columns *prev_sel = &all_columns;
+  int k;
+
+  memset(&p, 0, sizeof(p));
+  p.buf = buf;
+  p.len = len;
+  p.sel = load->columns;
+  p.budget = budget;
+  p.progress = progress;
+  if (prev && prev->columns) prev_sel = prev->columns;
+  for (k=0; p.pos < len; ++k) {
+    gint64 trace = trace_begin();
+    const struct dataset *old = NULL;
+    if (prev && k < prev->dataset_used) old = &prev->dataset[k];
+
+    struct dataset ds;
+    gsize start = p.start = p.pos;
+    gboolean same_bytes = old && can_reuse(&p, old);
+    if (same_bytes && same_columns(old->file_cols, prev_sel, p.sel)) {
+      /* the dataset is unchanged, or rows have been appended */
+      ds = *old;
+      ds.stable_rows = old->rows;
+      p.pos = p.rows_end = start + old->length;
+      p.borrowed = TRUE;
+      p.kept = 0;
+    } else if (same_bytes && ! old->reduction) {
+      /* the same bytes, but different columns are shown */
+      if (! reproject(&p, old, prev_sel, &ds, &load->err)) break;
+      p.pos = p.rows_end = start + old->length;
+      p.borrowed = FALSE;
+      p.kept = 0;
+      p.allocated = ds.rows;
+    } else {
+      memset(&ds, 0, sizeof(ds));
+      p.borrowed = FALSE;
+      p.kept = 0;
+      p.allocated = 0;
+    }
+
+    parse_rows(&p, &ds, &load->err);
+    if (! ds.rows
+        || g_error_matches(load->err, JVQPLOT_ERROR,
+                           JVQPLOT_ERROR_CORRUPTED)) {
+      if (! p.borrowed) discard_dataset(&ds, p.kept);
+      break;
+    }
+    if (! p.borrowed) {
+      finish_dataset(&p, &ds);
+      ds.length = p.rows_end - start;
+      ds.hash = hash_bytes(HASH_INIT, buf+start, ds.length);
+    } else {
+      p.used += dataset_bytes(&ds);
     }
+    add_dataset(load, &ds, p.borrowed, p.kept);
+    trace_end(trace, p.borrowed ? "reuse dataset" : "parse dataset",
+              "rows", ds.rows);
+    if (load->err) break;
   }
 
-  result = g_renew(double, result, result_used);
-  *rows_ret = rows;
-  *cols_ret = (cols==1) ? 2 : cols;
-  return result;
+  /* if the file grows, reading can continue after the last row */
+  if (load->dataset_used
+      && (! load->err || g_error_matches(load->err, JVQPLOT_ERROR,
+                                         JVQPLOT_ERROR_INCOMPLETE))) {
+    const struct dataset *last = &load->dataset[load->dataset_used-1];
+    if (last->ends_line && ! last->offset) load->tail = p.rows_end;
+  }
 }
 
-void
-read_data(GFile *file)
+static gboolean
+tail_hash(GInputStream *in, gsize tail, guint64 *hash)
+/* Hash the bytes just before `tail', leaving the stream at `tail'.  */
 {
-  GError *err = NULL;
-  int  rows, cols;
+  gsize n = MIN(tail, TAIL_CHECK);
+  gchar buf[TAIL_CHECK];
+  gsize got;
 
-  if (! file) {
-    update_message("data file removed");
-    return;
+  if (! g_seekable_seek(G_SEEKABLE(in), tail-n, G_SEEK_SET, NULL, NULL)
+      || ! g_input_stream_read_all(in, buf, n, &got, NULL, NULL)
+      || got != n)
+    return FALSE;
+  *hash = hash_bytes(HASH_INIT, buf, n);
+  return TRUE;
+}
+
+static gboolean
+can_resume(GInputStream *in, goffset size, const struct source *prev,
+           const struct columns *sel)
+/* Check whether the file only grew since `prev' was read.  Only the
+ * bytes just before the end of the last data row are compared,
+ * rewriting the file in place with the same tail is not noticed.  If
+ * the check succeeds, the stream is left at the old tail.  */
+{
+  const struct columns *prev_sel = prev->columns;
+  guint64 hash;
+  int k;
+
+  if (! prev->tail || (goffset)prev->tail > size || ! prev->dataset_used)
+    return FALSE;
+  for (k=0; k<prev->dataset_used; ++k) {
+    if (! prev_sel
+        || ! same_columns(prev->dataset[k].file_cols, prev_sel, sel))
+      return FALSE;
   }
+  return tail_hash(in, prev->tail, &hash) && hash == prev->tail_hash;
+}
+
+struct restart {
+  goffset offset;               /* file offset where reading can restart */
+  guint64 pos;                  /* the corresponding decompressed position */
+};
 
-  GFileInputStream *in = g_file_read(file, NULL, &err);
-  if (err) {
-    update_message(err->message);
-    g_clear_error(&err);
+static GBytes *
+read_chunk(GInputStream *in, struct decoder *decoder, goffset *restart,
+           GError **err)
+/* Return the next piece of (decompressed) input, or NULL at the end.
+ * If reading can restart at the beginning of the piece, `*restart' is
+ * set to the file offset, and otherwise to -1.  */
+{
+  if (decoder) return decoder_next(decoder, restart);
+
+  *restart = g_seekable_tell(G_SEEKABLE(in));
+  GBytes *bytes = g_input_stream_read_bytes(in, STREAM_CHUNK, NULL, err);
+  if (bytes && g_bytes_get_size(bytes) == 0) {
+    g_bytes_unref(bytes);
+    bytes = NULL;
+  }
+  return bytes;
+}
+
+static void
+stream_datasets(struct load *load, GInputStream *in, goffset size,
+                const struct source *prev, gsize budget,
+                enum compression compression, gint *progress)
+/* Parse the file while reading it, keeping only a small window of the
+ * input in memory.  This is used for files larger than the memory
+ * budget, for compressed files, and to read the rows appended to a
+ * file.  If `prev' is given, can_resume() has succeeded and reading
+ * continues after the last data row of `prev'; for compressed files
+ * this is only possible from the start of a gzip member or zstd
+ * frame.  A final line without newline is left for the next load,
+ * since it may still be being written.  */
+{
+  GByteArray *buffer = g_byte_array_new();
+  GArray *restart = g_array_new(FALSE, FALSE, sizeof(struct restart));
+  struct decoder *decoder = NULL;
+  struct parse p;
+  struct dataset ds;
+  guint64 base = 0;             /* decompressed position of the buffer */
+  guint64 tail = 0;
+  gsize skip = 0;
+  int k;
+
+  memset(&p, 0, sizeof(p));
+  p.sel = load->columns;
+  p.budget = budget;
+  p.streaming = TRUE;
+  memset(&ds, 0, sizeof(ds));
+  if (prev) {
+    for (k=0; k<prev->dataset_used-1; ++k) {
+      ds = prev->dataset[k];
+      ds.stable_rows = ds.rows;
+      add_dataset(load, &ds, TRUE, 0);
+      p.used += dataset_bytes(&ds);
+    }
+    ds = prev->dataset[k];
+    ds.stable_rows = ds.rows;
+    p.borrowed = TRUE;
+    tail = skip = prev->tail_skip;
+  } else if (! g_seekable_seek(G_SEEKABLE(in), 0, G_SEEK_SET,
+                               NULL, &load->err)) {
+    g_array_free(restart, TRUE);
+    g_byte_array_free(buffer, TRUE);
     return;
   }
-  GDataInputStream *inn = g_data_input_stream_new(G_INPUT_STREAM(in));
-  g_object_unref(in);
 
-  int dataset_used = 0;
-  int dataset_allocated = 4;
-  struct dataset *dataset = g_new(struct dataset, dataset_allocated);
-  double *data;
-  while ((data = parse_data_file(inn, &rows, &cols, &err))) {
-    if (dataset_used >= dataset_allocated) {
-      dataset_allocated *= 2;
-      dataset = g_renew(struct dataset, dataset, dataset_allocated);
-    }
-    dataset[dataset_used].data = data;
-    dataset[dataset_used].rows = rows;
-    dataset[dataset_used].cols = cols;
-    dataset_used += 1;
-    if (err) break;
-  }
-  if (dataset_used == 0) {
-    g_set_error(&err, JVQPLOT_ERROR, JVQPLOT_ERROR_CORRUPTED,
+  struct restart r = { g_seekable_tell(G_SEEKABLE(in)), 0 };
+  g_array_append_val(restart, r);
+  if (compression) decoder = start_decoder(in, compression, r.offset);
+
+  for (;;) {
+    GBytes *bytes = read_chunk(in, decoder, &r.offset, &load->err);
+    if (! bytes) break;
+    gsize n;
+    const guint8 *data = g_bytes_get_data(bytes, &n);
+    if (r.offset >= 0) {
+      r.pos = base + buffer->len;
+      g_array_append_val(restart, r);
+    }
+    if (skip) {
+      /* the rows up to the old tail have been read before */
+      gsize drop = MIN(skip, n);
+      data += drop;
+      n -= drop;
+      skip -= drop;
+      base += drop;
+    }
+    g_byte_array_append(buffer, data, n);
+    g_bytes_unref(bytes);
+
+    /* only parse complete lines */
+    gint64 trace = trace_begin();
+    gsize len = buffer->len;
+    while (len > 0 && buffer->data[len-1] != '\n') --len;
+    p.buf = (const gchar *)buffer->data;
+    p.len = len;
+    p.pos = p.rows_end = 0;
+    while (p.pos < p.len && ! load->err) {
+      p.ended = FALSE;
+      parse_rows(&p, &ds, &load->err);
+      if (p.ended) {
+        finish_dataset(&p, &ds);
+        add_dataset(load, &ds, p.borrowed, p.kept);
+        memset(&ds, 0, sizeof(ds));
+        p.borrowed = FALSE;
+        p.kept = 0;
+        p.allocated = 0;
+      }
+    }
+    if (p.rows_end) {
+      tail = base + p.rows_end;
+      /* keep only the last restart point before the tail */
+      while (restart->len > 1
+             && g_array_index(restart, struct restart, 1).pos <= tail)
+        g_array_remove_index(restart, 0);
+    }
+    if (load->err) break;
+    g_byte_array_remove_range(buffer, 0, len);
+    base += len;
+    trace_end(trace, "parse chunk", "bytes", len);
+
+    if (size > 0) {
+      goffset pos = decoder ? decoder_tell(decoder)
+        : g_seekable_tell(G_SEEKABLE(in));
+      set_progress(progress, (double)pos/size);
+    }
+  }
+  g_byte_array_free(buffer, TRUE);
+
+  gboolean truncated = FALSE;
+  if (decoder) finish_decoder(decoder, &truncated,
+                              load->err ? NULL : &load->err);
+
+  if (ds.rows && ! load->err) {
+    finish_dataset(&p, &ds);
+    add_dataset(load, &ds, p.borrowed, p.kept);
+  } else if (! p.borrowed) {
+    discard_dataset(&ds, p.kept);
+  }
+  if (truncated && ! load->err) {
+    g_set_error(&load->err, JVQPLOT_ERROR, JVQPLOT_ERROR_INCOMPLETE,
+                "incomplete input (truncated compressed data)");
+  }
+
+  r = g_array_index(restart, struct restart, 0);
+  g_array_free(restart, TRUE);
+  if (load->dataset_used && r.offset > 0) {
+    load->tail = r.offset;
+    load->tail_skip = tail - r.pos;
+    if (! tail_hash(in, load->tail, &load->tail_hash)) load->tail = 0;
+  }
+}
+
+static goffset
+file_size(GFileInputStream *in)
+{
+  GFileInfo *info = g_file_input_stream_query_info(in,
+                                          G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                          NULL, NULL);
+  goffset size = info ? g_file_info_get_size(info) : 0;
+  if (info) g_object_unref(info);
+  return size;
+}
+
+struct load *
+load_data(GFile *file, const struct source *prev,
+          const struct columns *sel, gsize budget, gint *progress)
+{
+  struct load *load = g_new0(struct load, 1);
+
+  load->columns = copy_columns(sel ? sel : &all_columns);
+
+  if (! file) {
+    g_set_error(&load->err, JVQPLOT_ERROR, JVQPLOT_ERROR_REMOVED,
+                "data file removed");
+    return load;
+  }
+
+  gint64 t0 = g_get_monotonic_time();
+  gint64 trace = trace_begin();
+  GFileInputStream *in = g_file_read(file, NULL, &load->err);
+  gint64 t1 = g_get_monotonic_time();
+  load->usec[STAGE_OPEN] = t1 - t0;
+  if (load->err) return load;
+
+  goffset size = file_size(in);
+  enum compression compression = detect_compression(G_INPUT_STREAM(in));
+  gboolean resume = prev
+    && can_resume(G_INPUT_STREAM(in), size, prev, load->columns);
+  if (compression || resume || (budget && size > (goffset)budget)) {
+    stream_datasets(load, G_INPUT_STREAM(in), size, resume ? prev : NULL,
+                    budget, compression, progress);
+  } else {
+    /* a private copy, since the file may be rewritten while parsing;
+     * can_resume() may have moved the stream */
+    gsize len;
+    gchar *buf = NULL;
+    if (g_seekable_seek(G_SEEKABLE(in), 0, G_SEEK_SET, NULL, &load->err))
+      buf = read_contents(G_INPUT_STREAM(in), size, &len, progress,
+                          &load->err);
+    if (buf) split_datasets(load, buf, len, prev, budget, progress);
+    g_free(buf);
+    if (load->tail
+        && ! tail_hash(G_INPUT_STREAM(in), load->tail, &load->tail_hash))
+      load->tail = 0;
+  }
+  if (load->dataset_used == 0 && ! load->err) {
+    g_set_error(&load->err, JVQPLOT_ERROR, JVQPLOT_ERROR_CORRUPTED,
                 "no data found");
   }
 
-  g_input_stream_close(G_INPUT_STREAM(inn), NULL, NULL);
-  g_object_unref(inn);
+  g_input_stream_close(G_INPUT_STREAM(in), NULL, NULL);
+  g_object_unref(in);
+  load->usec[STAGE_PARSE] = g_get_monotonic_time() - t1;
+  trace_end(trace, "load", "bytes", size);
+  return load;
+}
+
+static struct load *
+preview_data(GFile *file, const struct columns *sel, int samples)
+/* Read the first data row of `samples' evenly spaced blocks of the
+ * file, as one dataset.  For files with only one column, the row
+ * numbers are estimated from the line length at the start of the
+ * file.  Returns NULL for small and for compressed files.  */
+{
+  GFileInputStream *fin = file ? g_file_read(file, NULL, NULL) : NULL;
+  if (! fin) return NULL;
+  GInputStream *in = G_INPUT_STREAM(fin);
+  goffset size = file_size(fin);
+  if (size < PREVIEW_MIN_SIZE || detect_compression(in)) {
+    g_object_unref(fin);
+    return NULL;
+  }
+
+  gint64 t0 = g_get_monotonic_time();
+  struct load *load = g_new0(struct load, 1);
+  load->columns = copy_columns(sel ? sel : &all_columns);
+  load->preview = TRUE;
+
+  struct parse p;
+  struct dataset ds;
+  memset(&p, 0, sizeof(p));
+  p.sel = load->columns;
+  p.streaming = TRUE;
+  memset(&ds, 0, sizeof(ds));
+
+  gchar buf[PREVIEW_BLOCK];
+  double line_length = 1;
+  int i, k;
+  for (i=0; i<samples; ++i) {
+    goffset pos = size * i / samples;
+    gsize len;
+    if (! g_seekable_seek(G_SEEKABLE(in), pos, G_SEEK_SET, NULL, NULL)
+        || ! g_input_stream_read_all(in, buf, sizeof(buf), &len, NULL, NULL))
+      break;
+
+    /* only use complete lines */
+    while (len > 0 && buf[len-1] != '\n') --len;
+    const gchar *end = buf + len;
+    const gchar *line = buf;
+    if (i == 0) {
+      int lines = 0;
+      for (k=0; k<(int)len; ++k) lines += buf[k] == '\n';
+      if (lines) line_length = (double)len / lines;
+    } else {
+      line = memchr(buf, '\n', len);
+      if (! line) continue;
+      line += 1;
+    }
+    while (line < end && (*line == '\n' || *line == '\r' || *line == '#'))
+      line = (const gchar *)memchr(line, '\n', end-line) + 1;
+    if (line >= end) continue;
+
+    GError *err = NULL;
+    int rows = ds.rows;
+    p.buf = line;
+    p.len = (const gchar *)memchr(line, '\n', end-line) + 1 - line;
+    p.pos = 0;
+    parse_rows(&p, &ds, &err);
+    if (err) {
+      /* e.g. a row of a dataset with a different number of columns */
+      g_error_free(err);
+      continue;
+    }
+    if (ds.rows > rows && ds.file_cols == 1) {
+      ds.data[rows*ds.cols] = (pos + (line-buf)) / line_length + 1;
+    }
+  }
+  g_input_stream_close(in, NULL, NULL);
+  g_object_unref(fin);
+
+  if (! ds.rows) {
+    free_dataset(&ds);
+    delete_load(load);
+    return NULL;
+  }
+  g_free(ds.offset);             /* not positions in any buffer */
+  ds.offset = NULL;
+  if (ds.file_cols == 1) {
+    ds.min[0] = ds.data[0];
+    ds.max[0] = ds.data[(ds.rows-1)*ds.cols];
+  }
+  finish_dataset(&p, &ds);
+  add_dataset(load, &ds, FALSE, 0);
+  load->usec[STAGE_PARSE] = g_get_monotonic_time() - t0;
+  return load;
+}
+
+gboolean
+load_is_preview(struct load *load)
+{
+  return load->preview;
+}
+
+void
+delete_load(struct load *load)
+{
+  int k;
+
+  for (k=0; k<load->dataset_used; ++k) {
+    if (! load->borrowed[k])
+      discard_dataset(&load->dataset[k], load->kept[k]);
+  }
+  g_free(load->dataset);
+  g_free(load->borrowed);
+  g_free(load->kept);
+  free_columns(load->columns);
+  if (load->err) g_error_free(load->err);
+  g_free(load);
+}
+
+static gchar *
+source_message(struct source *src, GError *err)
+{
+  GString *message = g_string_new(err ? err->message : NULL);
+  gint64 kept = 0;
+  gint64 read = 0;
+  int k;
+
+  for (k=0; k<src->dataset_used; ++k) {
+    if (! src->dataset[k].reduction) continue;
+    kept += src->dataset[k].rows;
+    read += rows_read(&src->dataset[k]);
+  }
+  if (read) {
+    if (message->len) g_string_append(message, "; ");
+    g_string_append_printf(message,
+                           "reduced to %" G_GINT64_FORMAT " of %"
+                           G_GINT64_FORMAT " rows (memory budget)",
+                           kept, read);
+  }
+  return g_string_free(message, message->len == 0);
+}
+
+static void
+append_rows(struct dataset *old, struct dataset *ds, int kept)
+/* `ds' only holds the rows after the first `kept' ones, which are
+ * still in the buffer of `old'.  Move the new rows to the end of that
+ * buffer, which `ds' then shares with `old'.  This runs on the main
+ * thread, since the buffer may move.  */
+{
+  gsize n = (gsize)(ds->rows - kept) * ds->cols;
+  double *data = g_renew(double, old->data, (gsize)ds->rows*ds->cols);
+  memcpy(data + (gsize)kept*ds->cols, ds->data, n*sizeof(double));
+  g_free(ds->data);
+  old->data = ds->data = data;
+
+  if (ds->offset && old->offset) {
+    gsize *offset = g_renew(gsize, old->offset, ds->rows);
+    memcpy(offset + kept, ds->offset, (ds->rows - kept)*sizeof(gsize));
+    g_free(ds->offset);
+    ds->offset = offset;
+  } else {
+    /* reproject() finds the rows again if needed */
+    g_free(ds->offset);
+    g_free(old->offset);
+    ds->offset = NULL;
+  }
+  old->offset = ds->offset;
+}
+
+void
+install_data(struct state *state, int s, struct load *load)
+{
+  struct source *src = &state->source[s];
+  int k;
+
+  state->stats.usec[STAGE_OPEN] = load->usec[STAGE_OPEN];
+  state->stats.usec[STAGE_PARSE] = load->usec[STAGE_PARSE];
+  state->stats.datasets_reused = load->reused;
+
+  gint64 trace = trace_begin();
+  int datasets = load->dataset_used;
+  stats_start(state, STAGE_UPDATE);
+  if (load->dataset_used > 0) {
+    gboolean shifted = load->dataset_used != src->dataset_used;
+    for (k=0; k<load->dataset_used; ++k) {
+      if (load->kept[k])
+        append_rows(&src->dataset[k], &load->dataset[k], load->kept[k]);
+    }
+    /* previews are not kept as ghosts */
+    update_source(state, s, load->dataset_used, load->dataset,
+                  ! src->preview && ! load->preview);
+    src->preview = load->preview;
+    load->dataset_used = 0;
+    load->dataset = NULL;
+    free_columns(src->columns);
+    src->columns = load->columns;
+    load->columns = NULL;
+    src->tail = load->tail;
+    src->tail_skip = load->tail_skip;
+    src->tail_hash = load->tail_hash;
+    merge_sources(state, s, shifted);
+  }
+  if (! load->preview) {
+    src->progress = -1;
+  } else if (src->progress < 0) {
+    src->progress = 0;
+  }
+  g_free(src->message);
+  src->message = source_message(src, load->err);
+  update_message(state);
+  stats_stop(state, STAGE_UPDATE);
+  delete_load(load);
+  trace_end(trace, "install", "datasets", datasets);
+
+  stats_reload_done(state);
+}
+
+void
+read_data(struct state *state, int s)
+{
+  struct source *src = &state->source[s];
+
+  install_data(state, s, load_data(src->file, src, &state->columns,
+                                   state->memory_budget/state->source_used,
+                                   NULL));
+}
+
+void
+show_progress(struct state *state, int s, int progress)
+{
+  state->source[s].progress = progress;
+  update_message(state);
+}
+
+
+static gboolean
+load_done_cb(gpointer data)
+{
+  struct load_job *job = data;
+
+  job->done(job->load, job->data);
+  if (job->file) g_object_unref(job->file);
+  free_columns(job->columns);
+  g_free(job);
+  return FALSE;
+}
+
+struct preview_job {
+  struct load *load;
+  load_done_func done;
+  gpointer data;
+};
+
+static gboolean
+preview_done_cb(gpointer data)
+{
+  struct preview_job *job = data;
+
+  job->done(job->load, job->data);
+  g_free(job);
+  return FALSE;
+}
+
+static void
+load_worker(gpointer data, gpointer user_data)
+{
+  struct load_job *job = data;
+  int n;
+
+  /* a sparse preview first, then a denser one; the idle callbacks run
+   * in order, so the full data is installed last */
+  for (n=job->samples; n && n<=16*job->samples; n*=16) {
+    struct load *preview = preview_data(job->file, job->columns, n);
+    if (! preview) break;
+    struct preview_job *pj = g_new(struct preview_job, 1);
+    pj->load = preview;
+    pj->done = job->done;
+    pj->data = job->data;
+    g_idle_add(preview_done_cb, pj);
+  }
+
+  job->load = load_data(job->file, job->prev, job->columns, job->budget,
+                        job->progress);
+  if (job->wait) {
+    g_mutex_lock(&job->wait->lock);
+    job->wait->pending -= 1;
+    g_cond_signal(&job->wait->done);
+    g_mutex_unlock(&job->wait->lock);
+  } else {
+    g_idle_add(load_done_cb, job);
+  }
+}
+
+static GThreadPool *
+load_pool(void)
+/* The worker threads shared by all states.  */
+{
+  static gsize initialised = 0;
+  static GThreadPool *pool;
+
+  if (g_once_init_enter(&initialised)) {
+    int n = CLAMP(g_get_num_processors(), 1, MAX_LOAD_THREADS);
+    pool = g_thread_pool_new(load_worker, NULL, n, FALSE, NULL);
+    g_once_init_leave(&initialised, 1);
+  }
+  return pool;
+}
+
+void
+load_data_async(GFile *file, const struct source *prev,
+                const struct columns *sel, gsize budget,
+                int samples, gint *progress,
+                load_done_func done, gpointer data)
+{
+  struct load_job *job = g_new0(struct load_job, 1);
+
+  job->file = file ? g_object_ref(file) : NULL;
+  /* the previews replace the data of `prev' while loading */
+  job->prev = samples ? NULL : prev;
+  job->columns = copy_columns(sel ? sel : &all_columns);
+  job->budget = budget;
+  job->samples = samples;
+  job->progress = progress;
+  job->done = done;
+  job->data = data;
+  g_thread_pool_push(load_pool(), job, NULL);
+}
+
+void
+read_all(struct state *state)
+{
+  struct load_wait wait;
+  int s;
+
+  if (! state->source_used) return;
+
+  g_mutex_init(&wait.lock);
+  g_cond_init(&wait.done);
+  wait.pending = state->source_used;
+  struct load_job *job = g_new0(struct load_job, state->source_used);
+  for (s=0; s<state->source_used; ++s) {
+    job[s].file = state->source[s].file;
+    job[s].prev = &state->source[s];
+    job[s].columns = &state->columns;
+    job[s].budget = state->memory_budget / state->source_used;
+    job[s].wait = &wait;
+    g_thread_pool_push(load_pool(), &job[s], NULL);
+  }
+
+  g_mutex_lock(&wait.lock);
+  while (wait.pending > 0) g_cond_wait(&wait.done, &wait.lock);
+  g_mutex_unlock(&wait.lock);
 
-  update_data(dataset_used, dataset);
-  if (err) {
-    update_message(err->message);
-    g_clear_error(&err);
+  for (s=0; s<state->source_used; ++s) {
+    install_data(state, s, job[s].load);
   }
+  g_free(job);
+  g_cond_clear(&wait.done);
+  g_mutex_clear(&wait.lock);
 }
@@ -0,0 +1,459 @@
+/* decompress.c - read gzip and zstd compressed data files
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#ifdef HAVE_ZSTD
+#  include <zstd.h>
+#endif
+
+#include "jvqplot.h"
+
+
+/* Compressed files are decoded by a separate thread, while the
+ * loading thread parses the decoded data.  The decoded data is passed
+ * on in chunks, and every chunk which starts a gzip member or a zstd
+ * frame carries the file offset of that member or frame.  Decoding
+ * can be restarted there later, which allows to follow compressed
+ * files which grow by whole members or frames.  */
+
+/* Compressed bytes read at a time.  */
+#define DECODE_CHUNK (1<<20)
+
+/* For zstd, this many compressed bytes are kept in memory, and the
+ * complete frames found there are decoded in parallel.  */
+#define DECODE_AHEAD (4<<20)
+
+/* Decoded chunks waiting for the parser.  */
+#define MAX_QUEUED 8
+
+
+struct chunk {
+  GBytes *bytes;
+  goffset frame;                /* file offset of the member or frame, or -1 */
+};
+
+struct decoder {
+  GInputStream *in;
+  enum compression compression;
+  goffset offset;               /* file offset of the next byte read,
+                                 * only changed with `lock' held */
+  GThread *thread;
+
+  GMutex lock;                  /* protects the fields below */
+  GCond cond;
+  GQueue queue;                 /* of struct chunk */
+  gboolean done;                /* the decoder thread has finished */
+  gboolean stop;                /* the parser has stopped reading */
+  gboolean truncated;           /* the input ended inside a member or frame */
+  GError *err;
+};
+
+
+enum compression
+detect_compression(GInputStream *in)
+/* Look at the first bytes of `in', and rewind it.  */
+{
+  static const guchar gzip_magic[] = { 0x1f, 0x8b };
+  static const guchar zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+  guchar magic[4];
+  gsize got;
+
+  if (! g_input_stream_read_all(in, magic, sizeof(magic), &got, NULL, NULL)
+      || ! g_seekable_seek(G_SEEKABLE(in), 0, G_SEEK_SET, NULL, NULL))
+    return COMPRESSION_NONE;
+  if (got >= 2 && memcmp(magic, gzip_magic, 2) == 0)
+    return COMPRESSION_GZIP;
+  if (got == 4 && memcmp(magic, zstd_magic, 4) == 0)
+    return COMPRESSION_ZSTD;
+  return COMPRESSION_NONE;
+}
+
+static gboolean
+put_chunk(struct decoder *d, GBytes *bytes, goffset frame)
+/* Pass decoded bytes to the parser, waiting while too many chunks
+ * are queued.  Returns FALSE if the parser stopped reading.  */
+{
+  if (g_bytes_get_size(bytes) == 0) {
+    g_bytes_unref(bytes);
+    return TRUE;
+  }
+
+  struct chunk *c = g_new(struct chunk, 1);
+  c->bytes = bytes;
+  c->frame = frame;
+
+  g_mutex_lock(&d->lock);
+  while (d->queue.length >= MAX_QUEUED && ! d->stop)
+    g_cond_wait(&d->cond, &d->lock);
+  gboolean ok = ! d->stop;
+  if (ok) {
+    g_queue_push_tail(&d->queue, c);
+    g_cond_broadcast(&d->cond);
+  }
+  g_mutex_unlock(&d->lock);
+
+  if (! ok) {
+    g_bytes_unref(bytes);
+    g_free(c);
+  }
+  return ok;
+}
+
+static gssize
+read_input(struct decoder *d, guchar *buf, gsize len)
+{
+  gssize n = g_input_stream_read(d->in, buf, len, NULL, &d->err);
+
+  if (n > 0) {
+    g_mutex_lock(&d->lock);
+    d->offset += n;
+    g_mutex_unlock(&d->lock);
+  }
+  return n;
+}
+
+static void
+decode_gzip(struct decoder *d)
+/* Files written by "gzip >>" consist of several members, which
+ * GZlibDecompressor treats as separate streams.  */
+{
+  GConverter *conv
+    = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+  guchar *in = g_malloc(DECODE_CHUNK);
+  guchar *out = g_malloc(DECODE_CHUNK);
+  goffset start = d->offset;    /* file offset of in[0] */
+  goffset frame = d->offset;
+  gboolean in_member = FALSE;
+  gsize len = 0;
+  gsize pos = 0;
+
+  for (;;) {
+    if (pos == len) {
+      start = d->offset;
+      gssize n = read_input(d, in, DECODE_CHUNK);
+      if (n <= 0) {
+        d->truncated = n == 0 && in_member;
+        break;
+      }
+      len = n;
+      pos = 0;
+    }
+
+    GError *err = NULL;
+    gsize got, made;
+    GConverterResult res = g_converter_convert(conv, in+pos, len-pos,
+                                               out, DECODE_CHUNK,
+                                               G_CONVERTER_NO_FLAGS,
+                                               &got, &made, &err);
+    if (res == G_CONVERTER_ERROR) {
+      if (g_error_matches(err, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT)) {
+        g_error_free(err);
+        pos = len;
+        continue;
+      }
+      g_set_error(&d->err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                  "invalid data (gzip: %s)", err->message);
+      g_error_free(err);
+      break;
+    }
+
+    pos += got;
+    if (got) in_member = TRUE;
+    if (made) {
+      if (! put_chunk(d, g_bytes_new(out, made), frame)) break;
+      frame = -1;
+    }
+    if (res == G_CONVERTER_FINISHED) {
+      /* another member may follow */
+      g_converter_reset(conv);
+      in_member = FALSE;
+      frame = start + pos;
+    }
+  }
+
+  g_free(out);
+  g_free(in);
+  g_object_unref(conv);
+}
+
+#ifdef HAVE_ZSTD
+struct frame_job {
+  const guchar *buf;
+  const gsize *pos;             /* frame i is buf[pos[i]], ..., buf[pos[i+1]-1] */
+  int from, to;
+  GByteArray **out;
+  const char *error;
+};
+
+static gpointer
+frame_thread(gpointer data)
+{
+  struct frame_job *job = data;
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+  gsize step = ZSTD_DStreamOutSize();
+  int i;
+
+  for (i=job->from; i<job->to && ! job->error; ++i) {
+    GByteArray *out = job->out[i] = g_byte_array_new();
+    ZSTD_inBuffer ib = { job->buf + job->pos[i], job->pos[i+1]-job->pos[i], 0 };
+    size_t ret;
+    do {
+      guint used = out->len;
+      g_byte_array_set_size(out, used + step);
+      ZSTD_outBuffer ob = { out->data + used, step, 0 };
+      ret = ZSTD_decompressStream(dctx, &ob, &ib);
+      g_byte_array_set_size(out, used + ob.pos);
+      if (ZSTD_isError(ret)) {
+        job->error = ZSTD_getErrorName(ret);
+      } else if (ret != 0 && ob.pos == 0 && ib.pos == ib.size) {
+        job->error = "truncated frame";
+      }
+    } while (ret != 0 && ! job->error);
+  }
+
+  ZSTD_freeDCtx(dctx);
+  return NULL;
+}
+
+static gboolean
+decode_frames(struct decoder *d, const guchar *buf, goffset start,
+              const gsize *pos, int n)
+/* Decode the complete frames starting at buf[pos[0]], ...,
+ * buf[pos[n-1]] in parallel.  */
+{
+  int n_threads = CLAMP(g_get_num_processors(), 1, MIN(n, 64));
+  struct frame_job *job = g_new(struct frame_job, n_threads);
+  GThread **thread = g_new(GThread *, n_threads);
+  GByteArray **out = g_new0(GByteArray *, n);
+  gboolean ok = TRUE;
+  int i, t;
+
+  for (t=0; t<n_threads; ++t) {
+    job[t].buf = buf;
+    job[t].pos = pos;
+    job[t].from = (gint64)n*t/n_threads;
+    job[t].to = (gint64)n*(t+1)/n_threads;
+    job[t].out = out;
+    job[t].error = NULL;
+  }
+  for (t=1; t<n_threads; ++t) {
+    thread[t] = g_thread_new("zstd", frame_thread, &job[t]);
+  }
+  frame_thread(&job[0]);
+  for (t=1; t<n_threads; ++t) g_thread_join(thread[t]);
+
+  for (t=0; t<n_threads && ok; ++t) {
+    if (! job[t].error) continue;
+    g_set_error(&d->err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "invalid data (zstd: %s)", job[t].error);
+    ok = FALSE;
+  }
+  for (i=0; i<n; ++i) {
+    if (! out[i]) continue;
+    if (ok) {
+      ok = put_chunk(d, g_byte_array_free_to_bytes(out[i]), start + pos[i]);
+    } else {
+      g_byte_array_free(out[i], TRUE);
+    }
+  }
+
+  g_free(out);
+  g_free(thread);
+  g_free(job);
+  return ok;
+}
+
+static void
+decode_zstd(struct decoder *d)
+/* Files written by "zstd" consist of a single frame, which is decoded
+ * as a stream.  Files written by "pzstd", or by appending, consist of
+ * many frames, which can be decoded in parallel.  */
+{
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+  GByteArray *buf = g_byte_array_new();
+  GArray *frames = g_array_new(FALSE, FALSE, sizeof(gsize));
+  guchar *out = g_malloc(DECODE_CHUNK);
+  goffset start = d->offset;    /* file offset of buf->data[0] */
+  goffset frame = -1;
+  gboolean eof = FALSE;
+  gboolean in_frame = FALSE;
+  gboolean pending = FALSE;     /* decoded data is waiting in `dctx' */
+  gsize pos = 0;
+
+  for (;;) {
+    if (! eof && buf->len - pos < DECODE_AHEAD) {
+      g_byte_array_remove_range(buf, 0, pos);
+      start += pos;
+      pos = 0;
+      guint used = buf->len;
+      g_byte_array_set_size(buf, used + DECODE_CHUNK);
+      gssize n = read_input(d, buf->data + used, DECODE_CHUNK);
+      g_byte_array_set_size(buf, used + MAX(n, 0));
+      if (n < 0) break;
+      if (n == 0) eof = TRUE;
+      continue;
+    }
+    if (pos == buf->len && ! pending) {
+      d->truncated = in_frame;
+      break;
+    }
+
+    if (! in_frame) {
+      /* look for complete frames */
+      gsize end = pos;
+      g_array_set_size(frames, 0);
+      g_array_append_val(frames, end);
+      while (end < buf->len) {
+        size_t n = ZSTD_findFrameCompressedSize(buf->data + end,
+                                                buf->len - end);
+        if (ZSTD_isError(n)) break;
+        end += n;
+        g_array_append_val(frames, end);
+      }
+      if (frames->len > 2) {
+        if (! decode_frames(d, buf->data, start, (gsize *)frames->data,
+                            frames->len-1))
+          break;
+        pos = end;
+        continue;
+      }
+      frame = start + pos;
+      in_frame = TRUE;
+    }
+
+    ZSTD_inBuffer ib = { buf->data + pos, buf->len - pos, 0 };
+    ZSTD_outBuffer ob = { out, DECODE_CHUNK, 0 };
+    size_t ret = ZSTD_decompressStream(dctx, &ob, &ib);
+    if (ZSTD_isError(ret)) {
+      g_set_error(&d->err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                  "invalid data (zstd: %s)", ZSTD_getErrorName(ret));
+      break;
+    }
+    pos += ib.pos;
+    if (ob.pos) {
+      if (! put_chunk(d, g_bytes_new(out, ob.pos), frame)) break;
+      frame = -1;
+    }
+    if (ret == 0) in_frame = FALSE;
+    pending = ret != 0 && ob.pos == ob.size;
+  }
+
+  g_free(out);
+  g_array_free(frames, TRUE);
+  g_byte_array_free(buf, TRUE);
+  ZSTD_freeDCtx(dctx);
+}
+#else
+static void
+decode_zstd(struct decoder *d)
+{
+  g_set_error(&d->err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+              "zstd compressed files are not supported");
+}
+#endif
+
+static gpointer
+decoder_thread(gpointer data)
+{
+  struct decoder *d = data;
+
+  if (d->compression == COMPRESSION_GZIP) {
+    decode_gzip(d);
+  } else {
+    decode_zstd(d);
+  }
+
+  g_mutex_lock(&d->lock);
+  d->done = TRUE;
+  g_cond_broadcast(&d->cond);
+  g_mutex_unlock(&d->lock);
+  return NULL;
+}
+
+struct decoder *
+start_decoder(GInputStream *in, enum compression compression, goffset offset)
+{
+  struct decoder *d = g_new0(struct decoder, 1);
+
+  d->in = in;
+  d->compression = compression;
+  d->offset = offset;
+  g_mutex_init(&d->lock);
+  g_cond_init(&d->cond);
+  g_queue_init(&d->queue);
+  d->thread = g_thread_new("decoder", decoder_thread, d);
+  return d;
+}
+
+GBytes *
+decoder_next(struct decoder *d, goffset *frame)
+{
+  g_mutex_lock(&d->lock);
+  while (g_queue_is_empty(&d->queue) && ! d->done)
+    g_cond_wait(&d->cond, &d->lock);
+  struct chunk *c = g_queue_pop_head(&d->queue);
+  g_cond_broadcast(&d->cond);
+  g_mutex_unlock(&d->lock);
+
+  if (! c) return NULL;
+  GBytes *bytes = c->bytes;
+  *frame = c->frame;
+  g_free(c);
+  return bytes;
+}
+
+goffset
+decoder_tell(struct decoder *d)
+/* The number of compressed bytes read so far.  */
+{
+  g_mutex_lock(&d->lock);
+  goffset offset = d->offset;
+  g_mutex_unlock(&d->lock);
+  return offset;
+}
+
+gboolean
+finish_decoder(struct decoder *d, gboolean *truncated, GError **err)
+{
+  struct chunk *c;
+
+  g_mutex_lock(&d->lock);
+  d->stop = TRUE;
+  g_cond_broadcast(&d->cond);
+  g_mutex_unlock(&d->lock);
+  g_thread_join(d->thread);
+
+  while ((c = g_queue_pop_head(&d->queue))) {
+    g_bytes_unref(c->bytes);
+    g_free(c);
+  }
+  gboolean ok = d->err == NULL;
+  if (d->err) g_propagate_error(err, d->err);
+  if (truncated) *truncated = d->truncated;
+  g_cond_clear(&d->cond);
+  g_mutex_clear(&d->lock);
+  g_free(d);
+  return ok;
+}
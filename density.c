@@ -0,0 +1,357 @@
+/* density.c - render dense point clouds as a 2D histogram
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+#include <math.h>
+
+#include <glib.h>
+#include <cairo.h>
+
+#include "jvqplot.h"
+
+
+/* Switch to the histogram once there are this many data points per
+ * pixel on average.  */
+#define DENSITY_THRESHOLD 8
+
+/* Below this number of points, binning is done on the calling
+ * thread, and every further thread gets at least this many points.
+ * The other threads bin into private histograms, which together use
+ * at most DENSITY_MEMORY bytes.  */
+#define DENSITY_MIN_PARALLEL 1000000
+#define DENSITY_MEMORY (64<<20)
+#define DENSITY_MAX_THREADS 64
+
+
+/* The histogram is kept between frames, so that appended rows only
+ * need to be binned once.  The cache is valid for one layout and
+ * for the data generation `generation'.  */
+struct density_cache {
+  int width, height;
+  double ax, bx, ay, by;
+  unsigned generation;
+  int dataset_used;
+  int *rows;                    /* number of rows binned, per dataset */
+  guint32 *count;
+  cairo_surface_t *image;
+};
+
+struct bin_wait {
+  GMutex lock;
+  GCond done;
+  int pending;
+};
+
+struct bin_job {
+  struct state *state;
+  struct layout *L;
+  int *from, *to;               /* row range, per dataset */
+  guint32 *count;
+  struct bin_wait *wait;
+};
+
+
+gboolean
+use_density(struct state *state, struct layout *L)
+{
+  double points = 0;
+  int k;
+
+  for (k=0; k<state->dataset_used; ++k) {
+    points += (double)state->dataset[k].rows * (state->dataset[k].cols-1);
+  }
+  return points > DENSITY_THRESHOLD * (double)L->width * L->height;
+}
+
+static void
+bin_rows(struct bin_job *job)
+{
+  struct state *state = job->state;
+  struct layout *L = job->L;
+  int w = L->width;
+  int h = L->height;
+  int i, j, k;
+
+  for (k=0; k<state->dataset_used; ++k) {
+    int cols = state->dataset[k].cols;
+    double *data = state->dataset[k].data;
+    for (i=job->from[k]; i<job->to[k]; ++i) {
+      const double *row = data + (gsize)i*cols;
+      double wx = L->ax*row[0] + L->bx;
+      if (! (wx >= 0 && wx < w)) continue;
+      int px = wx;
+      for (j=1; j<cols; ++j) {
+        double wy = L->ay*row[j] + L->by;
+        if (! (wy >= 0 && wy < h)) continue;
+        int py = wy;
+        job->count[py*w + px] += 1;
+      }
+    }
+  }
+}
+
+static void
+bin_worker(gpointer data, gpointer user_data)
+{
+  struct bin_job *job = data;
+
+  bin_rows(job);
+  g_mutex_lock(&job->wait->lock);
+  job->wait->pending -= 1;
+  g_cond_signal(&job->wait->done);
+  g_mutex_unlock(&job->wait->lock);
+}
+
+static GThreadPool *
+bin_pool(void)
+/* The worker threads shared by all states.  */
+{
+  static gsize initialised = 0;
+  static GThreadPool *pool;
+
+  if (g_once_init_enter(&initialised)) {
+    int n = CLAMP(g_get_num_processors()-1, 1, DENSITY_MAX_THREADS);
+    pool = g_thread_pool_new(bin_worker, NULL, n, FALSE, NULL);
+    g_once_init_leave(&initialised, 1);
+  }
+  return pool;
+}
+
+static void
+reset_cache(struct density_cache *cache, struct layout *L)
+{
+  int n = L->width * L->height;
+
+  if (cache->width != L->width || cache->height != L->height) {
+    g_free(cache->count);
+    cache->count = g_new(guint32, n);
+    if (cache->image) cairo_surface_destroy(cache->image);
+    cache->image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                              L->width, L->height);
+  }
+  memset(cache->count, 0, n * sizeof(guint32));
+  cache->width = L->width;
+  cache->height = L->height;
+  cache->ax = L->ax;
+  cache->bx = L->bx;
+  cache->ay = L->ay;
+  cache->by = L->by;
+  cache->dataset_used = 0;
+}
+
+static gboolean
+cache_is_appendable(struct state *state, struct layout *L)
+{
+  struct density_cache *cache = state->density_cache;
+  int k;
+
+  if (cache->width != L->width || cache->height != L->height
+      || cache->ax != L->ax || cache->bx != L->bx
+      || cache->ay != L->ay || cache->by != L->by)
+    return FALSE;
+  if (cache->generation+1 != state->generation)
+    return FALSE;
+  if (cache->dataset_used > state->dataset_used)
+    return FALSE;
+  for (k=0; k<cache->dataset_used; ++k) {
+    if (state->dataset[k].stable_rows < cache->rows[k])
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static void
+update_histogram(struct state *state, struct layout *L)
+{
+  struct density_cache *cache = state->density_cache;
+  int n = L->width * L->height;
+  int *from = g_new(int, state->dataset_used);
+  double points = 0;
+  int i, k, t;
+
+  for (k=0; k<state->dataset_used; ++k) {
+    from[k] = (k < cache->dataset_used) ? cache->rows[k] : 0;
+    points += (double)(state->dataset[k].rows - from[k])
+      * (state->dataset[k].cols-1);
+  }
+
+  /* enough points per thread, and room for the private histograms */
+  double by_points = points / DENSITY_MIN_PARALLEL;
+  double by_memory = 1 + DENSITY_MEMORY / (n * (double)sizeof(guint32));
+  int n_threads = MIN(MIN(by_points, by_memory),
+                      MIN(g_get_num_processors(), DENSITY_MAX_THREADS));
+  n_threads = MAX(n_threads, 1);
+
+  if (n_threads == 1) {
+    int *to = g_new(int, state->dataset_used);
+    for (k=0; k<state->dataset_used; ++k) to[k] = state->dataset[k].rows;
+    struct bin_job job = { state, L, from, to, cache->count, NULL };
+    bin_rows(&job);
+    g_free(to);
+  } else {
+    /* every thread bins a slice of each dataset, the pool threads
+     * into private histograms which are added up afterwards */
+    struct bin_wait wait;
+    struct bin_job *job = g_new(struct bin_job, n_threads);
+    g_mutex_init(&wait.lock);
+    g_cond_init(&wait.done);
+    wait.pending = n_threads-1;
+    for (t=0; t<n_threads; ++t) {
+      job[t].state = state;
+      job[t].L = L;
+      job[t].from = g_new(int, state->dataset_used);
+      job[t].to = g_new(int, state->dataset_used);
+      for (k=0; k<state->dataset_used; ++k) {
+        gint64 len = state->dataset[k].rows - from[k];
+        job[t].from[k] = from[k] + len*t/n_threads;
+        job[t].to[k] = from[k] + len*(t+1)/n_threads;
+      }
+      job[t].count = (t == 0) ? cache->count : g_new0(guint32, n);
+      job[t].wait = &wait;
+    }
+    for (t=1; t<n_threads; ++t) {
+      g_thread_pool_push(bin_pool(), &job[t], NULL);
+    }
+    bin_rows(&job[0]);
+    g_mutex_lock(&wait.lock);
+    while (wait.pending > 0) g_cond_wait(&wait.done, &wait.lock);
+    g_mutex_unlock(&wait.lock);
+    for (t=1; t<n_threads; ++t) {
+      for (i=0; i<n; ++i) cache->count[i] += job[t].count[i];
+      g_free(job[t].count);
+    }
+    for (t=0; t<n_threads; ++t) {
+      g_free(job[t].from);
+      g_free(job[t].to);
+    }
+    g_cond_clear(&wait.done);
+    g_mutex_clear(&wait.lock);
+    g_free(job);
+  }
+  g_free(from);
+
+  cache->rows = g_renew(int, cache->rows, MAX(state->dataset_used, 1));
+  for (k=0; k<state->dataset_used; ++k) {
+    cache->rows[k] = state->dataset[k].rows;
+  }
+  cache->dataset_used = state->dataset_used;
+  cache->generation = state->generation;
+}
+
+static void
+tone_map(struct density_cache *cache, double r, double g, double b)
+{
+  int w = cache->width;
+  int h = cache->height;
+  guint32 max = 0;
+  int i, x, y;
+
+  for (i=0; i<w*h; ++i) {
+    if (cache->count[i] > max) max = cache->count[i];
+  }
+  double scale = 1/log1p(max > 0 ? max : 1);
+
+  cairo_surface_flush(cache->image);
+  unsigned char *pixels = cairo_image_surface_get_data(cache->image);
+  int stride = cairo_image_surface_get_stride(cache->image);
+  for (y=0; y<h; ++y) {
+    guint32 *row = (guint32 *)(pixels + y*stride);
+    guint32 *count = cache->count + y*w;
+    for (x=0; x<w; ++x) {
+      if (count[x] == 0) {
+        row[x] = 0;
+        continue;
+      }
+      /* logarithmic scale, isolated points remain visible */
+      double alpha = .25 + .75*log1p(count[x])*scale;
+      guint32 a = 255*alpha + .5;
+      row[x] = a<<24 | (guint32)(r*a + .5)<<16
+        | (guint32)(g*a + .5)<<8 | (guint32)(b*a + .5);
+    }
+  }
+  cairo_surface_mark_dirty(cache->image);
+}
+
+cairo_surface_t *
+density_image(struct state *state, struct layout *L,
+              double r, double g, double b)
+{
+  struct density_cache *cache = state->density_cache;
+
+  if (! cache) {
+    cache = state->density_cache = g_new0(struct density_cache, 1);
+    cache->width = -1;
+  }
+
+  if (cache->generation == state->generation
+      && cache->width == L->width && cache->height == L->height
+      && cache->ax == L->ax && cache->bx == L->bx
+      && cache->ay == L->ay && cache->by == L->by)
+    return cache->image;
+
+  if (! cache_is_appendable(state, L)) reset_cache(cache, L);
+  update_histogram(state, L);
+  tone_map(cache, r, g, b);
+  return cache->image;
+}
+
+cairo_surface_t *
+scaled_density_image(struct state *state, struct layout *L, double scale,
+                     double r, double g, double b)
+/* Like density_image(), but with `scale' pixels per layout unit.  The
+ * image is not cached and the caller must destroy it; this only reads
+ * the datasets of `state', so it can run on a separate thread.  */
+{
+  struct density_cache cache;
+  struct layout S = *L;
+  int k;
+
+  S.width = ceil(L->width * scale);
+  S.height = ceil(L->height * scale);
+  S.ax *= scale;
+  S.bx *= scale;
+  S.ay *= scale;
+  S.by *= scale;
+  memset(&cache, 0, sizeof(cache));
+  cache.width = -1;
+  reset_cache(&cache, &S);
+
+  int *from = g_new0(int, MAX(state->dataset_used, 1));
+  int *to = g_new(int, MAX(state->dataset_used, 1));
+  for (k=0; k<state->dataset_used; ++k) to[k] = state->dataset[k].rows;
+  struct bin_job job = { state, &S, from, to, cache.count, NULL };
+  bin_rows(&job);
+  tone_map(&cache, r, g, b);
+  g_free(to);
+  g_free(from);
+  g_free(cache.count);
+  return cache.image;
+}
+
+void
+delete_density_cache(struct density_cache *cache)
+{
+  g_free(cache->rows);
+  g_free(cache->count);
+  if (cache->image) cairo_surface_destroy(cache->image);
+  g_free(cache);
+}
@@ -21,15 +21,16 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include <cairo.h>
+#include <cairo-pdf.h>
+#include <cairo-svg.h>
 
 #include "jvqplot.h"
 
 
-double xres = -1, yres;
-
 static struct {
   double r, g, b;
 } colors[100] = {
@@ -135,18 +136,161 @@ static struct {
   { 0.500000, 0.500000, 0.500000},
 };
 
+/* Polylines are stroked in pieces of this many points, so that
+ * drawing can be interrupted.  The translucent halo of a polyline with
+ * several pieces is first drawn opaque into a mask, which is painted
+ * once the last piece is done, so that it is not painted twice where
+ * the pieces meet.  */
+#define CHUNK_ROWS 16384
+
+/* For printing and for PDF and SVG files, polylines are reduced to at
+ * most four points per device pixel column.  If there are more than
+ * VECTOR_MAX_POINTS points in total after this, which happens for
+ * data whose x-values go back and forth, the data is shown as a
+ * density image instead, with at most VECTOR_MAX_PIXELS pixels, so
+ * that the size of the output is bounded.  */
+#define VECTOR_MAX_POINTS 1000000
+#define VECTOR_MAX_PIXELS (16<<20)
+
+/* Ghosts are drawn with at most this many points per pixel column,
+ * by skipping rows.  */
+#define GHOST_POINTS 4
+
+/* At most this many column names are listed in the legend.  */
+#define LEGEND_ENTRIES 20
+
+struct polyline {
+  int color;
+  int n, allocated;
+  double *xy;                   /* in layout coordinates */
+};
+struct vector_plot {
+  int n_lines;
+  struct polyline *line;
+  cairo_surface_t *image;       /* used instead of `line', if set */
+  double scale;                 /* image pixels per layout unit */
+};
+
+/* Once a plot has LAYER_MIN_POINTS points, draw_graph() draws the
+ * datasets into transparent layers on several threads and paints the
+ * layers over the background in the usual order.  A layer holds some
+ * consecutive datasets, or some of the columns of one dataset if there
+ * are fewer datasets than layers.  All layers together use at most
+ * LAYER_MEMORY bytes.  Layers whose datasets did not change are kept
+ * for the next frame.  */
+#define LAYER_MIN_POINTS 100000
+#define LAYER_MEMORY (64<<20)
+#define MAX_LAYERS 64
+
+struct layer {
+  int k0, k1;                   /* the datasets k0, ..., k1-1 */
+  int j0, j1;                   /* the columns, or 1 and -1 for all */
+  guint64 key;                  /* the data drawn, 0 if not reusable */
+  cairo_surface_t *surface;
+  double stroked;
+};
+struct layer_cache {
+  int width, height;
+  double ax, bx, ay, by;
+  cairo_antialias_t antialias;
+  int n_layers;
+  struct layer layer[MAX_LAYERS];
+};
+struct layer_job {
+  struct layout *L;
+  cairo_antialias_t antialias;
+  struct layer **todo;
+  int n_todo;
+  gint next;
+};
+
+static gboolean
+data_as_image(struct state *state, struct layout *L)
+{
+  /* wide matrices are shown as an image, and if the points far
+   * outnumber the pixels, we show their density */
+  return state->matrix || use_density(state, L);
+}
+
+double
+draw_cost(struct state *state, struct layout *L)
+{
+  double points = 0;
+  int k;
+
+  if (! state->dataset_used || data_as_image(state, L)) return 0;
+  for (k=0; k<state->dataset_used; ++k) {
+    points += (double)state->dataset[k].rows * (state->dataset[k].cols-1);
+  }
+  return points;
+}
+
+static void
+draw_ghosts(struct state *state, cairo_t *cr, struct layout *L)
+/* Older ghosts are fainter.  */
+{
+  int i, j;
+
+  cairo_set_line_width(cr, 1.5);
+  cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
+  for (i=0; i<state->ghost_used; ++i) {
+    struct ghost *g = &state->ghost[i];
+    const double *data = ghost_data(state, g);
+    int stride = g->rows / (GHOST_POINTS*L->width) + 1;
+    double alpha = .4 * (state->history - g->age + 1) / state->history;
+    int r;
+
+    for (j=1; j<g->cols; ++j) {
+      int ci = g->color[j];
+      cairo_set_source_rgba(cr, colors[ci].r, colors[ci].g, colors[ci].b,
+                            alpha);
+      for (r=0; ; r+=stride) {
+        if (r > g->rows-1) r = g->rows-1;
+        double wx = L->ax*data[(gsize)r*g->cols] + L->bx;
+        double wy = L->ay*data[(gsize)r*g->cols+j] + L->by;
+        if (r == 0) {
+          cairo_move_to(cr, wx, wy);
+        } else {
+          cairo_line_to(cr, wx, wy);
+        }
+        if (r == g->rows-1) break;
+      }
+      cairo_stroke(cr);
+    }
+  }
+}
+
 void
-draw_graph(cairo_t *cr, struct layout *L, gboolean is_screen)
+draw_background(struct state *state, cairo_t *cr, struct layout *L,
+                gboolean is_screen)
 {
-  int i, j, k;
+  int i;
 
   cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
   cairo_paint(cr);
 
   if (! state->dataset_used)
-    goto draw_message;
+    return;
+
+  gint64 trace = trace_begin();
+  if (data_as_image(state, L)) {
+    cairo_surface_t *image;
+    if (state->matrix) {
+      image = matrix_image(state, L);
+    } else {
+      image = density_image(state, L,
+                            colors[0].r, colors[0].g, colors[0].b);
+    }
+    cairo_set_source_surface(cr, image, 0, 0);
+    cairo_paint(cr);
+    trace_end(trace, "image", NULL, 0);
+  } else {
+    draw_ghosts(state, cr, L);
+    trace_end(trace, "ghosts", "count", state->ghost_used);
+  }
 
   /* minor grid lines */
+  trace = trace_begin();
   cairo_set_line_width(cr, 1);
   cairo_set_source_rgb(cr, 0.85, 0.85, 0.85);
   for (i=ceil(-L->bx/L->ax/L->dx); ; ++i) {
@@ -187,8 +331,10 @@ draw_graph(cairo_t *cr, struct layout *L, gboolean is_screen)
     cairo_line_to(cr, L->width, wy);
   }
   cairo_stroke(cr);
+  trace_end(trace, "grid", NULL, 0);
 
   /* grid labels */
+  trace = trace_begin();
   cairo_select_font_face(cr, "sans-serif",
                          CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
   cairo_set_font_size(cr, 12.0);
@@ -199,7 +345,11 @@ draw_graph(cairo_t *cr, struct layout *L, gboolean is_screen)
     if (is_screen) wx = floor(wx) + .5;
 
     char buffer[32];
-    snprintf(buffer, 32, "%g", i*L->dx);
+    if (L->time_x) {
+      format_time(i*L->dx, L->xmult*L->dx, buffer, 32);
+    } else {
+      snprintf(buffer, 32, "%g", i*L->dx);
+    }
 
     cairo_text_extents_t te;
     cairo_text_extents(cr, buffer, &te);
@@ -239,66 +389,220 @@ draw_graph(cairo_t *cr, struct layout *L, gboolean is_screen)
     cairo_move_to(cr, 8, wy+4);
     cairo_show_text(cr, buffer);
   }
+  trace_end(trace, "labels", NULL, 0);
+}
 
-  /* graphs for the data */
-  for (k=0; k<state->dataset_used; ++k) {
-    int cols = state->dataset[k].cols;
-    int rows = state->dataset[k].rows;
-    double *data = state->dataset[k].data;
-    for (j=1; j<cols; ++j) {
-      cairo_set_source_rgba(cr, 1, 1, 1, .5);
-      if (rows == 1) {
-        double x = data[0];
-        double y = data[j];
-        cairo_arc(cr, L->ax*x + L->bx, L->ay*y + L->by, 6, 0, 2*M_PI);
-        cairo_close_path(cr);
-        cairo_fill(cr);
-      } else {
-        cairo_set_line_width(cr, 6);
-        cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
-        cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
-        for (i=0; i<rows; ++i) {
-          double x = data[i*cols];
-          double y = data[i*cols+j];
-          double wx = L->ax*x + L->bx;
-          double wy = L->ay*y + L->by;
-          if (i == 0) {
-            cairo_move_to(cr, wx, wy);
-          } else {
-            cairo_line_to(cr, wx, wy);
-          };
-        }
-        cairo_stroke(cr);
+static void
+set_color(cairo_t *cr, int ci, int pass)
+{
+  if (pass == 0) {
+    cairo_set_source_rgba(cr, 1, 1, 1, .5);
+  } else {
+    cairo_set_source_rgb(cr, colors[ci].r, colors[ci].g, colors[ci].b);
+  }
+}
+
+static gboolean
+chunked(const struct dataset *ds, int stride)
+/* Whether the columns of `ds' are stroked in several pieces.  */
+{
+  return (ds->rows-1)/stride > CHUNK_ROWS;
+}
+
+static int
+draw_chunk(double *stroked, cairo_t *cr, struct layout *L,
+           struct dataset *ds, int j, int pass, int from, int stride)
+/* Draw one pass (0 for the white background, 1 for the coloured
+ * line) of column `j' in the current source, starting at row `from'
+ * and using every `stride'th row.  In pass 1, the number of new
+ * points is added to `*stroked'; row `from' was counted with the
+ * previous piece, unless it is 0.  The function returns the last row
+ * drawn.  */
+{
+  int cols = ds->cols;
+  int rows = ds->rows;
+  double *data = ds->data;
+  int i;
+
+  if (rows == 1) {
+    double x = data[0];
+    double y = data[j];
+    cairo_arc(cr, L->ax*x + L->bx, L->ay*y + L->by, pass ? 4 : 6,
+              0, 2*M_PI);
+    cairo_close_path(cr);
+    cairo_fill(cr);
+    if (pass) *stroked += 1;
+    return 0;
+  }
+
+  int to = rows-1;
+  if ((to-from)/stride > CHUNK_ROWS) to = from + CHUNK_ROWS*stride;
+
+  cairo_set_line_width(cr, pass ? 2 : 6);
+  cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
+  cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+  for (i=from; ; i+=stride) {
+    if (i > to) i = to;
+    double x = data[i*cols];
+    double y = data[i*cols+j];
+    double wx = L->ax*x + L->bx;
+    double wy = L->ay*y + L->by;
+    if (i == from) {
+      cairo_move_to(cr, wx, wy);
+    } else {
+      cairo_line_to(cr, wx, wy);
+    }
+    if (i == to) break;
+  }
+  cairo_stroke(cr);
+  if (pass) *stroked += (to-from+stride-1)/stride + (from == 0);
+  return to;
+}
+
+gboolean
+draw_data(struct state *state, cairo_t *cr, struct layout *L, int stride,
+          struct draw_pos *pos, gint64 deadline)
+{
+  if (! state->dataset_used || data_as_image(state, L))
+    return TRUE;
+
+  while (pos->k < state->dataset_used) {
+    struct dataset *ds = &state->dataset[pos->k];
+    if (pos->j < 1) pos->j = 1;
+    if (pos->j >= ds->cols) {
+      pos->k += 1;
+      pos->j = 1;
+      pos->pass = pos->row = 0;
+      continue;
+    }
+
+    int last;
+    if (pos->pass == 0 && chunked(ds, stride)) {
+      if (! pos->halo) {
+        pos->halo = cairo_surface_create_similar(cairo_get_group_target(cr),
+                                                 CAIRO_CONTENT_ALPHA,
+                                                 L->width, L->height);
       }
+      cairo_t *mask = cairo_create(pos->halo);
+      cairo_set_antialias(mask, cairo_get_antialias(cr));
+      last = draw_chunk(&state->stats.points_stroked, mask, L, ds,
+                        pos->j, pos->pass, pos->row, stride);
+      cairo_destroy(mask);
+      if (last == ds->rows-1) {
+        cairo_save(cr);
+        cairo_identity_matrix(cr);
+        set_color(cr, 0, 0);
+        cairo_mask_surface(cr, pos->halo, 0, 0);
+        cairo_restore(cr);
+        cairo_surface_destroy(pos->halo);
+        pos->halo = NULL;
+      }
+    } else {
+      set_color(cr, (ds->color + dataset_column(ds, pos->j)-1)%100,
+                pos->pass);
+      last = draw_chunk(&state->stats.points_stroked, cr, L, ds,
+                        pos->j, pos->pass, pos->row, stride);
+    }
+    if (last < ds->rows-1) {
+      pos->row = last;
+    } else if (pos->pass == 0) {
+      pos->pass = 1;
+      pos->row = 0;
+    } else {
+      pos->j += 1;
+      pos->pass = pos->row = 0;
+    }
 
-      int ci = (j-1)%100;
-      cairo_set_source_rgb(cr, colors[ci].r, colors[ci].g, colors[ci].b);
-      if (rows == 1) {
-        double x = data[0];
-        double y = data[j];
-        cairo_arc(cr, L->ax*x + L->bx, L->ay*y + L->by, 4, 0, 2*M_PI);
-        cairo_close_path(cr);
-        cairo_fill(cr);
-      } else {
-        cairo_set_line_width(cr, 2);
-        for (i=0; i<rows; ++i) {
-          double x = data[i*cols];
-          double y = data[i*cols+j];
-          double wx = L->ax*x + L->bx;
-          double wy = L->ay*y + L->by;
-          if (i == 0) {
-            cairo_move_to(cr, wx, wy);
-          } else {
-            cairo_line_to(cr, wx, wy);
-          };
-        }
-        cairo_stroke(cr);
+    if (deadline && g_get_monotonic_time() >= deadline)
+      return pos->k >= state->dataset_used;
+  }
+  return TRUE;
+}
+
+void
+clear_draw_pos(struct draw_pos *pos)
+{
+  if (pos->halo) cairo_surface_destroy(pos->halo);
+  memset(pos, 0, sizeof(struct draw_pos));
+}
+
+void
+draw_legend(struct state *state, cairo_t *cr, struct layout *L)
+/* List the column names found in header rows in the top right
+ * corner.  Columns with the same name and colour are listed once.  */
+{
+  const gchar *name[LEGEND_ENTRIES];
+  int color[LEGEND_ENTRIES];
+  gboolean more = FALSE;
+  int n = 0;
+  int i, j, k, pass;
+
+  if (! state->dataset_used || data_as_image(state, L)) return;
+  for (k=0; k<state->dataset_used; ++k) {
+    struct dataset *ds = &state->dataset[k];
+    for (j=1; j<ds->cols; ++j) {
+      const gchar *s = column_name(ds, j);
+      if (! s) continue;
+      int ci = (ds->color + dataset_column(ds, j)-1)%100;
+      for (i=0; i<n; ++i) {
+        if (color[i] == ci && strcmp(name[i], s) == 0) break;
+      }
+      if (i < n) continue;
+      if (n == LEGEND_ENTRIES) {
+        more = TRUE;
+        continue;
       }
+      name[n] = s;
+      color[n] = ci;
+      n += 1;
+    }
+  }
+  if (! n) return;
+
+  cairo_select_font_face(cr, "sans-serif",
+                         CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size(cr, 12.0);
+  cairo_font_extents_t fe;
+  cairo_font_extents(cr, &fe);
+  double width = 0;
+  for (i=0; i<n; ++i) {
+    cairo_text_extents_t te;
+    cairo_text_extents(cr, name[i], &te);
+    if (te.x_advance > width) width = te.x_advance;
+  }
+
+  double x0 = L->width - width - 48;
+  double y0 = 8;
+  cairo_rectangle(cr, x0, y0, width+40, (n + more)*fe.height + 8);
+  cairo_set_source_rgba(cr, 1, 1, 1, .8);
+  cairo_fill(cr);
+
+  cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+  for (i=0; i<n+more; ++i) {
+    double y = y0 + 4 + (i+.5)*fe.height;
+    double baseline = y + (fe.ascent - fe.descent)/2;
+    if (i == n) {
+      cairo_set_source_rgb(cr, 0, 0, 0);
+      cairo_move_to(cr, x0+34, baseline);
+      cairo_show_text(cr, "\342\200\246"); /* ellipsis */
+      break;
+    }
+    for (pass=0; pass<2; ++pass) {
+      set_color(cr, color[i], pass);
+      cairo_set_line_width(cr, pass ? 2 : 6);
+      cairo_move_to(cr, x0+8, y);
+      cairo_line_to(cr, x0+26, y);
+      cairo_stroke(cr);
     }
+    cairo_set_source_rgb(cr, 0, 0, 0);
+    cairo_move_to(cr, x0+34, baseline);
+    cairo_show_text(cr, name[i]);
   }
+}
 
- draw_message:
-  /* state messages */
+void
+draw_message(struct state *state, cairo_t *cr, gboolean is_screen)
+{
   if (state->message && is_screen) {
     cairo_select_font_face(cr, "sans-serif",
                            CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
@@ -306,8 +610,8 @@ draw_graph(cairo_t *cr, struct layout *L, gboolean is_screen)
 
     cairo_text_extents_t te;
     cairo_text_extents(cr, state->message, &te);
-    double xpos = xres/2.54 - te.x_bearing;
-    double ypos = yres/2.54 - te.y_bearing;
+    double xpos = state->xres/2.54 - te.x_bearing;
+    double ypos = state->yres/2.54 - te.y_bearing;
     cairo_rectangle(cr, xpos+te.x_bearing-2, ypos+te.y_bearing-2,
                     te.width+4, te.height+4);
     cairo_set_source_rgba(cr, 1, 1, 1, .8);
@@ -318,3 +622,523 @@ draw_graph(cairo_t *cr, struct layout *L, gboolean is_screen)
     cairo_show_text(cr, state->message);
   }
 }
+
+void
+draw_stats(struct state *state, cairo_t *cr, struct layout *L)
+{
+  struct stats *stats = &state->stats;
+  int i, k;
+
+  if (! stats->show) return;
+
+  cairo_select_font_face(cr, "monospace",
+                         CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size(cr, 11.0);
+
+  int n_lines = N_STAGES + 5 + MIN(state->dataset_used, 8);
+  gchar **line = g_new0(gchar *, n_lines+1);
+  int n = 0;
+  for (i=0; i<N_STAGES; ++i) {
+    line[n++] = g_strdup_printf("%-8s %8.1f ms", stage_name[i],
+                                stats->usec[i] / 1000.0);
+  }
+  line[n++] = g_strdup_printf("fps      %8.1f", stats_fps(state));
+  line[n++] = g_strdup_printf("points   %.0f/%.0f",
+                              stats->points_drawn, stats->points_submitted);
+  line[n++] = g_strdup_printf("events   %d (%d coalesced)",
+                              stats->events, stats->events_coalesced);
+  line[n++] = g_strdup_printf("layers   %d/%d drawn",
+                              stats->layers_drawn, stats->layers);
+  for (k=0; k<state->dataset_used && n<n_lines-1; ++k) {
+    line[n++] = g_strdup_printf("set %-4d %8.1f MB", k,
+                                dataset_bytes(&state->dataset[k]) / 1e6);
+  }
+  if (k < state->dataset_used) {
+    line[n++] = g_strdup_printf("(%d more)", state->dataset_used-k);
+  }
+
+  /* place the box at the top right corner */
+  double width = 0;
+  double height = 14;
+  for (i=0; i<n; ++i) {
+    cairo_text_extents_t te;
+    cairo_text_extents(cr, line[i], &te);
+    if (te.x_advance > width) width = te.x_advance;
+  }
+  double right = L ? L->width : 2*state->xres;
+  double xpos = right - state->xres/2.54 - width;
+  double ypos = state->yres/2.54;
+  cairo_rectangle(cr, xpos-4, ypos-4, width+8, n*height+8);
+  cairo_set_source_rgba(cr, 1, 1, 1, .8);
+  cairo_fill(cr);
+
+  cairo_set_source_rgb(cr, 0, 0, .6);
+  for (i=0; i<n; ++i) {
+    cairo_move_to(cr, xpos, ypos + (i+1)*height - 3);
+    cairo_show_text(cr, line[i]);
+  }
+  g_strfreev(line);
+}
+
+static void
+add_point(struct polyline *pl, struct layout *L, const double *row, int j)
+{
+  if (pl->n >= pl->allocated) {
+    pl->allocated = MAX(2*pl->allocated, 64);
+    pl->xy = g_renew(double, pl->xy, 2*pl->allocated);
+  }
+  pl->xy[2*pl->n] = L->ax*row[0] + L->bx;
+  pl->xy[2*pl->n+1] = L->ay*row[j] + L->by;
+  pl->n += 1;
+}
+
+static void
+add_run(struct polyline *pl, struct layout *L, const struct dataset *ds,
+        int j, int first, int lo, int hi, int last)
+/* Add the rows `first', ..., `last', which fall into the same pixel
+ * column, as the first and last point together with the lowest and
+ * highest point, in file order.  */
+{
+  int row[4] = { first, MIN(lo, hi), MAX(lo, hi), last };
+  int prev = -1;
+  int t;
+
+  for (t=0; t<4; ++t) {
+    if (row[t] == prev) continue;
+    add_point(pl, L, ds->data + (gsize)row[t]*ds->cols, j);
+    prev = row[t];
+  }
+}
+
+static void
+decimate_column(struct polyline *pl, struct layout *L,
+                const struct dataset *ds, int j, double scale)
+/* `scale' is the number of device pixels per layout unit.  */
+{
+  const double *data = ds->data;
+  int cols = ds->cols;
+  int first = 0, lo = 0, hi = 0;
+  double col = 0;
+  int i;
+
+  pl->color = (ds->color + dataset_column(ds, j)-1)%100;
+  pl->n = 0;
+  for (i=0; i<ds->rows; ++i) {
+    const double *row = data + (gsize)i*cols;
+    double c = floor((L->ax*row[0] + L->bx) * scale);
+    if (i == 0 || c != col) {
+      if (i > 0) add_run(pl, L, ds, j, first, lo, hi, i-1);
+      first = lo = hi = i;
+      col = c;
+    } else if (row[j] < data[(gsize)lo*cols+j]) {
+      lo = i;
+    } else if (row[j] > data[(gsize)hi*cols+j]) {
+      hi = i;
+    }
+  }
+  if (ds->rows > 0) add_run(pl, L, ds, j, first, lo, hi, ds->rows-1);
+}
+
+struct vector_plot *
+decimate_data(struct state *state, struct layout *L, double scale,
+              gint *progress)
+/* This only reads the datasets of `state', so it can run on a
+ * separate thread while the state is drawn elsewhere.  `*progress' is
+ * set to the fraction of rows processed, in units of 0.1%.  */
+{
+  struct vector_plot *plot = g_new0(struct vector_plot, 1);
+  double work = 0;
+  int j, k, n;
+
+  if (! state->dataset_used || data_as_image(state, L)) return plot;
+
+  gint64 trace = trace_begin();
+  for (k=0; k<state->dataset_used; ++k) {
+    plot->n_lines += state->dataset[k].cols-1;
+    work += (double)state->dataset[k].rows * (state->dataset[k].cols-1);
+  }
+  plot->line = g_new0(struct polyline, plot->n_lines);
+
+  double done = 0;
+  gsize total = 0;
+  n = 0;
+  for (k=0; k<state->dataset_used && total<=VECTOR_MAX_POINTS; ++k) {
+    struct dataset *ds = &state->dataset[k];
+    for (j=1; j<ds->cols && total<=VECTOR_MAX_POINTS; ++j) {
+      decimate_column(&plot->line[n], L, ds, j, scale);
+      total += plot->line[n++].n;
+      done += ds->rows;
+      if (progress) g_atomic_int_set(progress, 1000*done/work);
+    }
+  }
+  trace_end(trace, "decimate", "points", work);
+  if (total <= VECTOR_MAX_POINTS) return plot;
+
+  /* the lines cannot be reduced without losing detail */
+  trace = trace_begin();
+  for (n=0; n<plot->n_lines; ++n) g_free(plot->line[n].xy);
+  plot->n_lines = 0;
+  double pixels = (double)L->width*L->height * scale*scale;
+  if (pixels > VECTOR_MAX_PIXELS) scale *= sqrt(VECTOR_MAX_PIXELS/pixels);
+  plot->scale = scale;
+  plot->image = scaled_density_image(state, L, scale, colors[0].r,
+                                     colors[0].g, colors[0].b);
+  trace_end(trace, "density", "points", work);
+  return plot;
+}
+
+void
+delete_vector_plot(struct vector_plot *plot)
+{
+  int n;
+
+  for (n=0; n<plot->n_lines; ++n) g_free(plot->line[n].xy);
+  g_free(plot->line);
+  if (plot->image) cairo_surface_destroy(plot->image);
+  g_free(plot);
+}
+
+void
+draw_vector_graph(struct state *state, cairo_t *cr, struct layout *L,
+                  struct vector_plot *plot)
+{
+  int i, n, pass;
+
+  draw_background(state, cr, L, FALSE);
+  if (plot->image) {
+    cairo_save(cr);
+    cairo_scale(cr, 1/plot->scale, 1/plot->scale);
+    cairo_set_source_surface(cr, plot->image, 0, 0);
+    cairo_paint(cr);
+    cairo_restore(cr);
+  }
+  cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
+  cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+  for (n=0; n<plot->n_lines; ++n) {
+    struct polyline *pl = &plot->line[n];
+    for (pass=0; pass<2; ++pass) {
+      set_color(cr, pl->color, pass);
+      if (pl->n == 1) {
+        cairo_arc(cr, pl->xy[0], pl->xy[1], pass ? 4 : 6, 0, 2*M_PI);
+        cairo_close_path(cr);
+        cairo_fill(cr);
+        continue;
+      }
+      cairo_set_line_width(cr, pass ? 2 : 6);
+      cairo_move_to(cr, pl->xy[0], pl->xy[1]);
+      for (i=1; i<pl->n; ++i) cairo_line_to(cr, pl->xy[2*i], pl->xy[2*i+1]);
+      cairo_stroke(cr);
+    }
+  }
+  draw_legend(state, cr, L);
+  draw_message(state, cr, FALSE);
+}
+
+cairo_status_t
+write_vector_plot(struct state *state, const gchar *format,
+                  double width, double height, double dpi,
+                  cairo_write_func_t write, void *closure)
+/* Write the plot as a PDF or SVG file of `width' times `height'
+ * points, reducing the data to the resolution `dpi'.  */
+{
+  cairo_surface_t *surface;
+
+  if (strcmp(format, "svg") == 0) {
+    surface = cairo_svg_surface_create_for_stream(write, closure,
+                                                  width, height);
+  } else {
+    surface = cairo_pdf_surface_create_for_stream(write, closure,
+                                                  width, height);
+  }
+
+  struct layout *L = new_layout(width, height, 72, 72,
+                                state->min[0], state->max[0],
+                                state->min[1], state->max[1],
+                                state->time_axis);
+  struct vector_plot *plot = decimate_data(state, L, dpi/72, NULL);
+  cairo_t *cr = cairo_create(surface);
+  draw_vector_graph(state, cr, L, plot);
+  cairo_destroy(cr);
+  delete_vector_plot(plot);
+  delete_layout(L);
+
+  cairo_surface_finish(surface);
+  cairo_status_t rc = cairo_surface_status(surface);
+  cairo_surface_destroy(surface);
+  return rc;
+}
+
+static guint64
+mix(guint64 h, guint64 x)
+{
+  h ^= x;
+  h *= G_GUINT64_CONSTANT(0x100000001b3);
+  return h ^ (h >> 29);
+}
+
+static guint64
+mix_columns(guint64 h, const struct columns *sel)
+/* The column selection decides the colours, and every reload gets a
+ * copy of it, so its contents are used instead of its address.  */
+{
+  int c;
+
+  if (! sel) return mix(h, 0);
+  h = mix(h, sel->len+1);
+  h = mix(h, sel->hide_rest);
+  for (c=0; c<sel->len; ++c) h = mix(h, sel->hidden[c]);
+  return h;
+}
+
+static guint64
+layer_key(struct state *state, struct layer *l)
+/* Datasets which were read again get new data, so the data pointer,
+ * size and hash of the input bytes identify the contents.  Previews
+ * have no hash and are always drawn again.  */
+{
+  guint64 h = mix(G_GUINT64_CONSTANT(0xcbf29ce484222325), l->j0);
+  int k;
+
+  h = mix(h, l->j1);
+  for (k=l->k0; k<l->k1; ++k) {
+    struct dataset *ds = &state->dataset[k];
+    if (! ds->length) return 0;
+    h = mix(h, (guint64)(gsize)ds->data);
+    h = mix_columns(h, ds->columns);
+    h = mix(h, ds->rows);
+    h = mix(h, ds->cols);
+    h = mix(h, ds->color);
+    h = mix(h, ds->length);
+    h = mix(h, ds->hash);
+  }
+  return h ? h : 1;
+}
+
+static int
+plan_layers(struct state *state, int max_layers, struct layer *layer)
+/* Split the data into at most `max_layers' layers.  The split only
+ * depends on the number of datasets and columns, so that it stays the
+ * same while rows are appended.  */
+{
+  int n = 0;
+  int k, g;
+
+  if (state->dataset_used >= max_layers) {
+    int per = (state->dataset_used + max_layers-1) / max_layers;
+    for (k=0; k<state->dataset_used; k+=per) {
+      layer[n].k0 = k;
+      layer[n].k1 = MIN(k+per, state->dataset_used);
+      layer[n].j0 = 1;
+      layer[n].j1 = -1;
+      n += 1;
+    }
+    return n;
+  }
+
+  int split = max_layers / state->dataset_used;
+  for (k=0; k<state->dataset_used; ++k) {
+    int values = state->dataset[k].cols - 1;
+    int m = MIN(split, values);
+    for (g=0; g<m; ++g) {
+      layer[n].k0 = k;
+      layer[n].k1 = k+1;
+      layer[n].j0 = 1 + values*g/m;
+      layer[n].j1 = 1 + values*(g+1)/m;
+      n += 1;
+    }
+  }
+  return n;
+}
+
+static void
+render_layer(struct state *state, struct layer_job *job, struct layer *l)
+/* Draw the columns of a layer in the same order as draw_data().  */
+{
+  gint64 trace = trace_begin();
+  cairo_t *cr = cairo_create(l->surface);
+  int j, k, pass;
+
+  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint(cr);
+  cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+  cairo_set_antialias(cr, job->antialias);
+  l->stroked = 0;
+  for (k=l->k0; k<l->k1; ++k) {
+    struct dataset *ds = &state->dataset[k];
+    int j1 = l->j1 < 0 ? ds->cols : l->j1;
+    for (j=l->j0; j<j1; ++j) {
+      int ci = (ds->color + dataset_column(ds, j)-1)%100;
+      for (pass=0; pass<2; ++pass) {
+        gboolean group = pass == 0 && chunked(ds, 1);
+        int row = 0;
+        int last;
+        if (group) {
+          cairo_push_group_with_content(cr, CAIRO_CONTENT_ALPHA);
+        } else {
+          set_color(cr, ci, pass);
+        }
+        do {
+          last = draw_chunk(&l->stroked, cr, job->L, ds, j, pass, row, 1);
+          row = last;
+        } while (last < ds->rows-1);
+        if (group) {
+          cairo_pattern_t *halo = cairo_pop_group(cr);
+          set_color(cr, ci, pass);
+          cairo_mask(cr, halo);
+          cairo_pattern_destroy(halo);
+        }
+      }
+    }
+  }
+  cairo_destroy(cr);
+  trace_end(trace, "layer", "points", l->stroked);
+}
+
+struct layer_thread {
+  struct state *state;
+  struct layer_job *job;
+};
+
+static gpointer
+layer_thread(gpointer data)
+{
+  struct layer_thread *t = data;
+  struct layer_job *job = t->job;
+  int i;
+
+  while ((i = g_atomic_int_add(&job->next, 1)) < job->n_todo) {
+    render_layer(t->state, job, job->todo[i]);
+  }
+  return NULL;
+}
+
+static gboolean
+draw_layers(struct state *state, cairo_t *cr, struct layout *L)
+/* Draw the data like draw_data() does, using several threads.  This
+ * returns FALSE without drawing anything if it is not worthwhile, or
+ * if `cr' does not map layout coordinates to whole pixels.  */
+{
+  cairo_matrix_t m;
+  int i, t;
+
+  state->stats.layers = state->stats.layers_drawn = 0;
+  cairo_get_matrix(cr, &m);
+  if (m.xx != 1 || m.yy != 1 || m.xy != 0 || m.yx != 0
+      || m.x0 != floor(m.x0) || m.y0 != floor(m.y0))
+    return FALSE;
+  if (g_get_num_processors() < 2 || draw_cost(state, L) < LAYER_MIN_POINTS)
+    return FALSE;
+  gsize layer_bytes = (gsize)4 * L->width * L->height;
+  int max_layers = CLAMP(LAYER_MEMORY / MAX(layer_bytes, 1), 1, MAX_LAYERS);
+  if (max_layers < 2) return FALSE;
+
+  struct layer_cache *cache = state->layer_cache;
+  if (! cache) cache = state->layer_cache = g_new0(struct layer_cache, 1);
+  cairo_antialias_t antialias = cairo_get_antialias(cr);
+  if (cache->width != L->width || cache->height != L->height
+      || cache->ax != L->ax || cache->bx != L->bx
+      || cache->ay != L->ay || cache->by != L->by
+      || cache->antialias != antialias) {
+    for (i=0; i<cache->n_layers; ++i) {
+      cairo_surface_destroy(cache->layer[i].surface);
+    }
+    cache->n_layers = 0;
+    cache->width = L->width;
+    cache->height = L->height;
+    cache->ax = L->ax;
+    cache->bx = L->bx;
+    cache->ay = L->ay;
+    cache->by = L->by;
+    cache->antialias = antialias;
+  }
+
+  /* keep the old layers whose contents are unchanged, and recycle the
+   * surfaces of the others */
+  struct layer layer[MAX_LAYERS];
+  struct layer *todo[MAX_LAYERS];
+  int n = plan_layers(state, max_layers, layer);
+  int n_todo = 0;
+  for (i=0; i<n; ++i) {
+    layer[i].key = layer_key(state, &layer[i]);
+    layer[i].surface = NULL;
+    for (t=0; t<cache->n_layers && layer[i].key; ++t) {
+      struct layer *old = &cache->layer[t];
+      if (old->surface && old->key == layer[i].key) {
+        layer[i].surface = old->surface;
+        old->surface = NULL;
+        break;
+      }
+    }
+    if (! layer[i].surface) todo[n_todo++] = &layer[i];
+  }
+  for (i=0, t=0; i<n_todo; ++i) {
+    while (t<cache->n_layers && ! cache->layer[t].surface) ++t;
+    if (t < cache->n_layers) {
+      todo[i]->surface = cache->layer[t].surface;
+      cache->layer[t++].surface = NULL;
+    } else {
+      todo[i]->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                    L->width, L->height);
+    }
+  }
+  for (; t<cache->n_layers; ++t) {
+    if (cache->layer[t].surface) cairo_surface_destroy(cache->layer[t].surface);
+  }
+
+  struct layer_job job = { L, antialias, todo, n_todo, 0 };
+  int n_threads = MIN(g_get_num_processors(), n_todo);
+  if (n_threads > 0) {
+    struct layer_thread *lt = g_new(struct layer_thread, n_threads);
+    GThread **thread = g_new(GThread *, n_threads);
+    for (t=0; t<n_threads; ++t) {
+      lt[t].state = state;
+      lt[t].job = &job;
+    }
+    for (t=1; t<n_threads; ++t) {
+      thread[t] = g_thread_new("layer", layer_thread, &lt[t]);
+    }
+    layer_thread(&lt[0]);
+    for (t=1; t<n_threads; ++t) g_thread_join(thread[t]);
+    g_free(thread);
+    g_free(lt);
+  }
+
+  for (i=0; i<n; ++i) {
+    cairo_set_source_surface(cr, layer[i].surface, 0, 0);
+    cairo_paint(cr);
+  }
+  for (i=0; i<n_todo; ++i) {
+    state->stats.points_stroked += todo[i]->stroked;
+  }
+  state->stats.layers = n;
+  state->stats.layers_drawn = n_todo;
+  memcpy(cache->layer, layer, n*sizeof(struct layer));
+  cache->n_layers = n;
+  return TRUE;
+}
+
+void
+delete_layer_cache(struct layer_cache *cache)
+{
+  int i;
+
+  for (i=0; i<cache->n_layers; ++i) {
+    cairo_surface_destroy(cache->layer[i].surface);
+  }
+  g_free(cache);
+}
+
+void
+draw_graph(struct state *state, cairo_t *cr, struct layout *L,
+           gboolean is_screen)
+{
+  struct draw_pos pos = { 0, 0, 0, 0, NULL };
+
+  draw_background(state, cr, L, is_screen);
+  gint64 trace = trace_begin();
+  double stroked = state->stats.points_stroked;
+  if (! draw_layers(state, cr, L)) draw_data(state, cr, L, 1, &pos, 0);
+  trace_end(trace, "data", "points", state->stats.points_stroked - stroked);
+  draw_legend(state, cr, L);
+  draw_message(state, cr, is_screen);
+}
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <gtk/gtk.h>
 #include <gio/gio.h>
@@ -30,6 +31,13 @@
 #include "jvqplot.h"
 
 
+static cairo_status_t
+write_file(void *closure, const unsigned char *data, unsigned int length)
+{
+    return fwrite(data, 1, length, closure) == length
+        ? CAIRO_STATUS_SUCCESS : CAIRO_STATUS_WRITE_ERROR;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -37,12 +45,33 @@ main(int argc, char **argv)
     gboolean gui;
 
     gboolean version_flag = FALSE;
+    gchar *socket_path = NULL;
+    int cache_size = 256;
+    gchar *columns = NULL;
+    int memory = 0;
+    int dpi = 300;
+    gboolean time_x = FALSE;
+    gchar *trace_file = NULL;
     GOptionEntry entries[] = {
         { "version", 'v', 0, G_OPTION_ARG_NONE, &version_flag,
           "Show version information", NULL },
+        { "columns", 'c', 0, G_OPTION_ARG_STRING, &columns,
+          "Only show the value columns in LIST, e.g. \"2,4-6\"", "LIST" },
+        { "memory", 'm', 0, G_OPTION_ARG_INT, &memory,
+          "Keep at most MB megabytes of data, reducing larger files", "MB" },
+        { "time", 't', 0, G_OPTION_ARG_NONE, &time_x,
+          "Label the x-axis as time, for seconds since 1970", NULL },
+        { "dpi", 0, 0, G_OPTION_ARG_INT, &dpi,
+          "Reduce lines in PDF and SVG output to DPI dots per inch", "DPI" },
+        { "serve", 0, 0, G_OPTION_ARG_FILENAME, &socket_path,
+          "Render plots for clients connecting to SOCKET", "SOCKET" },
+        { "cache-size", 0, 0, G_OPTION_ARG_INT, &cache_size,
+          "Keep up to MB megabytes of data in memory when serving", "MB" },
+        { "trace", 0, 0, G_OPTION_ARG_FILENAME, &trace_file,
+          "Write a timeline of the work done to FILE", "FILE" },
         { NULL, '\0', 0, 0, NULL, NULL, NULL }
     };
-    gui = gtk_init_with_args(&argc, &argv, "width height datafile outfile.png", entries, NULL, &err);
+    gui = gtk_init_with_args(&argc, &argv, "width height datafile... outfile.{png,pdf,svg}", entries, NULL, &err);
     if (err) {
         fprintf(stderr, "%s\n", err->message);
         g_clear_error(&err);
@@ -63,29 +92,76 @@ main(int argc, char **argv)
         puts("There is NO WARRANTY, to the extent permitted by law.");
         exit(0);
     }
+    if (trace_file && ! trace_start(trace_file, &err)) {
+        fprintf(stderr, "error: %s\n", err->message);
+        exit(1);
+    }
+    if (socket_path) {
+        if (argc>1) {
+            fprintf(stderr, "error: too many arguments\n");
+            exit(1);
+        }
+        serve_plots(socket_path, (gsize)MAX(cache_size, 0) << 20,
+                    MAX(dpi, 1), g_get_num_processors(), &err);
+        fprintf(stderr, "error: cannot serve on \"%s\": %s\n",
+                socket_path, err->message);
+        exit(1);
+    }
     if (argc<5) {
         fprintf(stderr, "error: no data file given\n");
         exit(1);
-    } else if (argc>5) {
-        fprintf(stderr, "error: too many arguments\n");
-        exit(1);
     }
 
     int width = atoi(argv[1]);
     int height = atoi(argv[2]);
-    const char *infile = argv[3];
-    const char *outfile = argv[4];
+    const char *outfile = argv[argc-1];
 
     /* read the data */
-    GFile *in;
-    in = g_file_new_for_commandline_arg(infile);
-    read_data(in);
-    g_object_unref(in);
+    struct state *state = new_state();
+    state->memory_budget = (gsize)MAX(memory, 0) << 20;
+    state->time_x = time_x;
+    if (columns && ! parse_columns(&state->columns, columns, &err)) {
+        fprintf(stderr, "error: %s\n", err->message);
+        exit(1);
+    }
+    int i;
+    for (i=3; i<argc-1; ++i) {
+        GFile *in;
+        in = g_file_new_for_commandline_arg(argv[i]);
+        add_source(state, in);
+        g_object_unref(in);
+    }
+    read_all(state);
+
+    /* PDF and SVG files are measured in points */
+    const char *ext = strrchr(outfile, '.');
+    if (ext && (g_ascii_strcasecmp(ext, ".pdf") == 0
+                || g_ascii_strcasecmp(ext, ".svg") == 0)) {
+        gchar *format = g_ascii_strdown(ext+1, -1);
+        FILE *out = fopen(outfile, "wb");
+        cairo_status_t rc = CAIRO_STATUS_WRITE_ERROR;
+        if (out) {
+            rc = write_vector_plot(state, format, width, height, MAX(dpi, 1),
+                                   write_file, out);
+            if (fclose(out) != 0 && rc == CAIRO_STATUS_SUCCESS)
+                rc = CAIRO_STATUS_WRITE_ERROR;
+        }
+        if (rc != CAIRO_STATUS_SUCCESS) {
+            fprintf(stderr, "error: cannot write \"%s\" (%s)\n",
+                    outfile, cairo_status_to_string(rc));
+            exit(1);
+        }
+        g_free(format);
+        delete_state(state);
+        if (trace_file) trace_stop();
+        return 0;
+    }
 
     struct layout *L;
-    L = new_layout(width, height, 96, 96,
+    L = new_layout(width, height, state->xres, state->yres,
                    state->min[0], state->max[0],
-                   state->min[1], state->max[1]);
+                   state->min[1], state->max[1],
+                   state->time_axis);
 
     /* generate the PNG plot */
     cairo_surface_t *surface;
@@ -93,7 +169,7 @@ main(int argc, char **argv)
 
     cairo_t *cr;
     cr = cairo_create(surface);
-    draw_graph(cr, L, FALSE);
+    draw_graph(state, cr, L, FALSE);
     cairo_destroy(cr);
 
     cairo_status_t rc;
@@ -106,5 +182,7 @@ main(int argc, char **argv)
 
     delete_layout(L);
     cairo_surface_destroy(surface);
+    delete_state(state);
+    if (trace_file) trace_stop();
     return 0;
 }
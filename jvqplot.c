@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include <gtk/gtk.h>
@@ -32,13 +33,119 @@
 #define _(str) str
 
 
+static struct state *state;
 static GtkWidget *window, *drawing_area;
 static GtkPrintSettings *settings = NULL;
+static GtkUIManager *menu_manager;
+static int n_files;
+static GFileMonitor **monitor;
+static struct recorder *recorder;
+static guint record_id = 0;
+
+
+/* Frames which take longer than FRAME_BUDGET microseconds are drawn
+ * progressively: first a preview using a subset of the data, then
+ * the full frame is built in an off-screen surface, in steps of
+ * FRAME_BUDGET, whenever the program is idle.  */
+#define FRAME_BUDGET 8000
+
+/* while the data changed during the last SETTLE_TIME microseconds,
+ * we use cheap antialiasing */
+#define SETTLE_TIME 500000
+
+/* while a recorded frame is drawn, reloads are held back, but newer
+ * data waits at most RECORD_HOLD microseconds before the frame is
+ * dropped */
+#define RECORD_HOLD 100000
+
+/* the popup menu offers to hide at most this many value columns */
+#define MAX_MENU_COLUMNS 32
+
+#if CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 12, 0)
+#  define CHEAP_ANTIALIAS CAIRO_ANTIALIAS_FAST
+#else
+#  define CHEAP_ANTIALIAS CAIRO_ANTIALIAS_NONE
+#endif
+
+static struct {
+  cairo_surface_t *surface;
+  struct layout L;
+  unsigned generation;
+  cairo_antialias_t antialias;
+  struct draw_pos pos;
+  gint64 busy;                  /* microseconds spent drawing so far */
+  double points;                /* number of points drawn so far */
+  gboolean done;
+  guint idle_id;
+} frame;
+static double usec_per_point = .1;
+static gint64 last_change = 0;
+static guint settle_id = 0;
+
+
+struct print_job {
+  GtkPrintOperation *operation;
+  cairo_t *cr;
+  struct layout *L;
+  struct vector_plot *plot;
+  GThread *thread;
+  gint progress;                /* in units of 0.1%, set by the thread */
+  guint progress_id;
+  gchar *title;
+  gint64 trace;
+};
+
+static gboolean
+print_progress(gpointer data)
+{
+  struct print_job *job = data;
+
+  gchar *title = g_strdup_printf(_("%s (preparing print, %d%%)"),
+                                 job->title,
+                                 g_atomic_int_get(&job->progress)/10);
+  gtk_window_set_title(GTK_WINDOW(window), title);
+  g_free(title);
+  return TRUE;
+}
 
+static gboolean
+print_done(gpointer data)
+{
+  struct print_job *job = data;
+  int i;
+
+  g_thread_join(job->thread);
+  draw_vector_graph(state, job->cr, job->L, job->plot);
+  gtk_print_operation_draw_page_finish(job->operation);
+  trace_end(job->trace, "print page", NULL, 0);
+
+  for (i=0; i<n_files; ++i) watch_hold(monitor[i], FALSE);
+  g_source_remove(job->progress_id);
+  gtk_window_set_title(GTK_WINDOW(window), job->title);
+  g_free(job->title);
+  delete_vector_plot(job->plot);
+  delete_layout(job->L);
+  g_object_unref(job->operation);
+  g_free(job);
+  return FALSE;
+}
+
+static gpointer
+print_thread(gpointer data)
+{
+  struct print_job *job = data;
+
+  /* the print context measures in device pixels */
+  job->plot = decimate_data(state, job->L, 1, &job->progress);
+  g_idle_add(print_done, job);
+  return NULL;
+}
 
 static void
 print_page(GtkPrintOperation *operation, GtkPrintContext *ctx,
            gint page_nr, gpointer data)
+/* The data is reduced to the printer resolution on a separate thread,
+ * while reloads are held back.  */
 {
   gdouble width = gtk_print_context_get_width(ctx);
   gdouble height = gtk_print_context_get_height(ctx);
@@ -48,6 +155,7 @@ print_page(GtkPrintOperation *operation, GtkPrintContext *ctx,
   double x1 = state->max[0];
   double y0 = state->min[1];
   double y1 = state->max[1];
+  int i;
 
   cairo_t *cr = gtk_print_context_get_cairo_context(ctx);
 
@@ -62,9 +170,18 @@ print_page(GtkPrintOperation *operation, GtkPrintContext *ctx,
     tmp = xres, xres = yres, yres = tmp;
   }
 
-  struct layout *L = new_layout(width, height, xres, yres, x0, x1, y0, y1);
-  draw_graph(cr, L, FALSE);
-  delete_layout(L);
+  struct print_job *job = g_new0(struct print_job, 1);
+  job->trace = trace_begin();
+  job->operation = g_object_ref(operation);
+  job->cr = cr;
+  job->L = new_layout(width, height, xres, yres, x0, x1, y0, y1,
+                      state->time_axis);
+  job->title = g_strdup(gtk_window_get_title(GTK_WINDOW(window)));
+  job->progress_id = g_timeout_add(200, print_progress, job);
+
+  gtk_print_operation_set_defer_drawing(operation);
+  for (i=0; i<n_files; ++i) watch_hold(monitor[i], TRUE);
+  job->thread = g_thread_new("print", print_thread, job);
 }
 
 static void
@@ -75,6 +192,7 @@ print_action(GtkAction *action, gpointer data)
   GtkPrintOperation *print = gtk_print_operation_new();
   if (settings) gtk_print_operation_set_print_settings(print, settings);
   gtk_print_operation_set_n_pages(print, 1);
+  gtk_print_operation_set_show_progress(print, TRUE);
   g_signal_connect(print, "draw_page", G_CALLBACK(print_page), NULL);
 
   GtkPrintOperationResult res;
@@ -88,6 +206,76 @@ print_action(GtkAction *action, gpointer data)
   g_object_unref(print);
 }
 
+static void
+cancel_frame(void)
+{
+  if (frame.idle_id) {
+    g_source_remove(frame.idle_id);
+    frame.idle_id = 0;
+  }
+  frame.done = FALSE;
+}
+
+static gboolean
+refine_frame(gpointer data)
+{
+  gint64 start = g_get_monotonic_time();
+
+  double stroked = state->stats.points_stroked;
+  cairo_t *cr = cairo_create(frame.surface);
+  cairo_set_antialias(cr, frame.antialias);
+  frame.done = draw_data(state, cr, &frame.L, 1, &frame.pos,
+                         start+FRAME_BUDGET);
+  cairo_destroy(cr);
+  frame.busy += g_get_monotonic_time() - start;
+  frame.points += state->stats.points_stroked - stroked;
+
+  if (! frame.done)
+    return TRUE;
+
+  double points = draw_cost(state, &frame.L);
+  if (points > 0) usec_per_point = frame.busy / points;
+  frame.idle_id = 0;
+  gtk_widget_queue_draw(drawing_area);
+  return FALSE;
+}
+
+static void
+start_frame(struct layout *L, cairo_antialias_t antialias)
+{
+  cancel_frame();
+
+  if (! frame.surface
+      || frame.L.width != L->width || frame.L.height != L->height) {
+    if (frame.surface) cairo_surface_destroy(frame.surface);
+    frame.surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                                               L->width, L->height);
+  }
+  frame.L = *L;
+  frame.generation = state->generation;
+  frame.antialias = antialias;
+  clear_draw_pos(&frame.pos);
+  frame.busy = 0;
+  frame.points = 0;
+
+  cairo_t *cr = cairo_create(frame.surface);
+  cairo_set_antialias(cr, antialias);
+  draw_background(state, cr, L, TRUE);
+  cairo_destroy(cr);
+
+  frame.idle_id = g_idle_add(refine_frame, NULL);
+}
+
+static gboolean
+frame_is_current(struct layout *L, cairo_antialias_t antialias)
+{
+  return frame.surface && frame.generation == state->generation
+    && frame.antialias == antialias
+    && frame.L.width == L->width && frame.L.height == L->height
+    && frame.L.ax == L->ax && frame.L.bx == L->bx
+    && frame.L.ay == L->ay && frame.L.by == L->by;
+}
+
 static gboolean
 expose_event_callback(GtkWidget *widget, GdkEventExpose *event,
                       gpointer data)
@@ -95,15 +283,6 @@ expose_event_callback(GtkWidget *widget, GdkEventExpose *event,
   int width = widget->allocation.width;
   int height = widget->allocation.height;
 
-  if (xres < 0) {
-    GdkScreen *screen = gtk_window_get_screen(GTK_WINDOW(window));
-    xres = gdk_screen_get_width(screen)/gdk_screen_get_width_mm(screen)*25.4;
-    yres = gdk_screen_get_height(screen)/gdk_screen_get_height_mm(screen)*25.4;
-    if (xres < 50 || xres > 350 || yres < 50 || yres > 350) {
-      xres = yres = 100;
-    }
-  }
-
   cairo_t *cr = gdk_cairo_create(event->window);
   cairo_rectangle(cr, event->area.x, event->area.y,
                   event->area.width, event->area.height);
@@ -117,6 +296,7 @@ expose_event_callback(GtkWidget *widget, GdkEventExpose *event,
     double x1 = L->ax*state->max[0]+L->bx;
     double y1 = L->ay*state->max[1]+L->by;
     if (L->width != width || L->height != height
+        || L->time_x != state->time_axis
         || x0 < 0 || x0 > width || y0 < 0 || y0 > height
         || x1 < 0 || x1 > width || y1 < 0 || y1 > height
         || x1-x0 < .6*width || y0-y1 < .2*height) {
@@ -125,36 +305,157 @@ expose_event_callback(GtkWidget *widget, GdkEventExpose *event,
     }
   }
   if (state->dataset_used && !L) {
-    L = new_layout(width, height, xres, yres,
+    stats_start(state, STAGE_LAYOUT);
+    L = new_layout(width, height, state->xres, state->yres,
                    state->min[0], state->max[0],
-                   state->min[1], state->max[1]);
+                   state->min[1], state->max[1],
+                   state->time_axis);
+    stats_stop(state, STAGE_LAYOUT);
   }
-  draw_graph(cr, L, TRUE);
+
+  gboolean streaming = g_get_monotonic_time() - last_change < SETTLE_TIME;
+  cairo_antialias_t antialias
+    = streaming ? CHEAP_ANTIALIAS : CAIRO_ANTIALIAS_DEFAULT;
+  double points = L ? draw_cost(state, L) : 0;
+  int stride = points*usec_per_point/FRAME_BUDGET + 1;
+  double stroked = state->stats.points_stroked;
+
+  stats_start(state, STAGE_DRAW);
+  if (stride <= 1) {
+    /* cheap enough to draw in one go */
+    cancel_frame();
+    cairo_set_antialias(cr, antialias);
+    draw_graph(state, cr, L, TRUE);
+    stroked = state->stats.points_stroked - stroked;
+  } else {
+    if (! frame_is_current(L, antialias)) start_frame(L, antialias);
+    if (frame.done) {
+      cairo_set_source_surface(cr, frame.surface, 0, 0);
+      cairo_paint(cr);
+      stroked = frame.points;
+    } else {
+      /* show a preview, using every stride'th data point */
+      struct draw_pos pos = { 0, 0, 0, 0, NULL };
+      cairo_set_antialias(cr, CHEAP_ANTIALIAS);
+      draw_background(state, cr, L, TRUE);
+      draw_data(state, cr, L, stride, &pos, 0);
+      stroked = state->stats.points_stroked - stroked;
+    }
+    draw_legend(state, cr, L);
+    draw_message(state, cr, TRUE);
+  }
+  stats_stop(state, STAGE_DRAW);
+  if (stride <= 1 && points >= 10000) {
+    usec_per_point = state->stats.usec[STAGE_DRAW] / points;
+  }
+  draw_stats(state, cr, L);
+  stats_frame_done(state, points, stroked);
 
   cairo_destroy(cr);
   return TRUE;
 }
 
-static void
-data_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file,
-                GFileMonitorEvent event_type, gpointer data)
+static gboolean
+settle_cb(gpointer data)
+{
+  /* redraw with full quality */
+  settle_id = 0;
+  gtk_widget_queue_draw(drawing_area);
+  return FALSE;
+}
+
+static void update_column_menu(void);
+
+static gboolean
+record_cb(gpointer data)
 {
-  switch (event_type) {
-  case G_FILE_MONITOR_EVENT_CHANGED:
-  case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
-  case G_FILE_MONITOR_EVENT_CREATED:
-    read_data(file);
-    break;
-  case G_FILE_MONITOR_EVENT_DELETED:
-    read_data(NULL);
-    break;
-  default:
-    break;
+  static gboolean held = FALSE;
+  static gint64 held_since;
+  int i;
+
+  /* large frames are drawn in several steps, while the data must not
+   * change; the window must not show old data for long, though */
+  if (held && g_get_monotonic_time() - held_since > RECORD_HOLD) {
+    for (i=0; i<n_files && ! watch_is_waiting(monitor[i]); ++i)
+      ;
+    if (i < n_files) drop_frame(recorder);
+  }
+
+  /* releasing the watches may install data and schedule the next
+   * frame */
+  gboolean busy = record_frame(recorder, state);
+  if (! busy) record_id = 0;
+  if (busy != held) {
+    held = busy;
+    held_since = g_get_monotonic_time();
+    for (i=0; i<n_files; ++i) watch_hold(monitor[i], busy);
   }
+  return busy;
+}
+
+static void
+data_reloaded(gpointer data)
+{
+  update_column_menu();
+  cancel_frame();
+  last_change = g_get_monotonic_time();
+  if (settle_id) g_source_remove(settle_id);
+  settle_id = g_timeout_add(SETTLE_TIME/1000 + 1, settle_cb, NULL);
+
   gtk_widget_queue_draw_area(drawing_area,
                              0, 0,
                              drawing_area->allocation.width,
                              drawing_area->allocation.height);
+
+  /* recorded frames are drawn after the window is updated */
+  if (recorder && ! record_id)
+    record_id = g_idle_add_full(G_PRIORITY_LOW, record_cb, NULL, NULL);
+}
+
+static struct {
+  gboolean mapped, iconified, obscured;
+  gboolean paused;
+} visibility;
+
+static void
+update_visibility(void)
+/* Nobody looks at a hidden window, so its files are only reloaded
+ * once it becomes visible again, unless the plot is recorded.  */
+{
+  gboolean hidden = (! visibility.mapped || visibility.iconified
+                     || visibility.obscured) && ! recorder;
+  int i;
+
+  if (hidden == visibility.paused) return;
+  visibility.paused = hidden;
+  for (i=0; i<n_files; ++i) watch_pause(monitor[i], hidden);
+}
+
+static gboolean
+map_cb(GtkWidget *widget, GdkEvent *event, gpointer data)
+{
+  visibility.mapped = event->type == GDK_MAP;
+  update_visibility();
+  return FALSE;
+}
+
+static gboolean
+window_state_cb(GtkWidget *widget, GdkEventWindowState *event,
+                gpointer data)
+{
+  visibility.iconified = (event->new_window_state
+                          & (GDK_WINDOW_STATE_ICONIFIED
+                             | GDK_WINDOW_STATE_WITHDRAWN)) != 0;
+  update_visibility();
+  return FALSE;
+}
+
+static gboolean
+visibility_cb(GtkWidget *widget, GdkEventVisibility *event, gpointer data)
+{
+  visibility.obscured = event->state == GDK_VISIBILITY_FULLY_OBSCURED;
+  update_visibility();
+  return FALSE;
 }
 
 static void
@@ -181,9 +482,74 @@ home_action(GtkAction *action, gpointer data)
                GDK_CURRENT_TIME, NULL);
 }
 
+static void
+stats_action(GtkToggleAction *action, gpointer data)
+{
+  state->stats.show = gtk_toggle_action_get_active(action);
+  gtk_widget_queue_draw(drawing_area);
+}
+
+static void
+column_action(GtkToggleAction *action, gpointer data)
+{
+  int c = GPOINTER_TO_INT(data);
+  int i;
+
+  set_column_hidden(&state->columns, c,
+                    ! gtk_toggle_action_get_active(action));
+  for (i=0; i<n_files; ++i) watch_reload(monitor[i]);
+}
+
+static void
+update_column_menu(void)
+/* Offer one toggle for every value column of the widest dataset.  */
+{
+  static GtkActionGroup *column_group = NULL;
+  static guint merge_id;
+  static int menu_cols = -1;
+  int file_cols = 0;
+  int c, k;
+
+  for (k=0; k<state->dataset_used; ++k) {
+    if (state->dataset[k].file_cols > file_cols)
+      file_cols = state->dataset[k].file_cols;
+  }
+  file_cols = MIN(file_cols, MAX_MENU_COLUMNS+1);
+  if (file_cols == menu_cols) return;
+  menu_cols = file_cols;
+
+  if (column_group) {
+    gtk_ui_manager_remove_ui(menu_manager, merge_id);
+    gtk_ui_manager_remove_action_group(menu_manager, column_group);
+    g_object_unref(column_group);
+  }
+  column_group = gtk_action_group_new("columns");
+  gtk_ui_manager_insert_action_group(menu_manager, column_group, 0);
+  merge_id = gtk_ui_manager_new_merge_id(menu_manager);
+  for (c=1; c<file_cols; ++c) {
+    gchar *name = g_strdup_printf("Column%dAction", c+1);
+    gchar *label = g_strdup_printf(_("Column %d"), c+1);
+    GtkToggleAction *action = gtk_toggle_action_new(name, label, NULL, NULL);
+    gtk_toggle_action_set_active(action,
+                                 ! column_hidden(&state->columns, c));
+    g_signal_connect(action, "toggled", G_CALLBACK(column_action),
+                     GINT_TO_POINTER(c));
+    gtk_action_group_add_action(column_group, GTK_ACTION(action));
+    g_object_unref(action);
+    gtk_ui_manager_add_ui(menu_manager, merge_id,
+                          "/MainMenu/Columns/ColumnItems", name, name,
+                          GTK_UI_MANAGER_MENUITEM, FALSE);
+    g_free(label);
+    g_free(name);
+  }
+}
+
 static const gchar *menu_def =
   "<ui>"
   "  <popup name=\"MainMenu\">"
+  "    <menu name=\"Columns\" action=\"ColumnsMenuAction\">"
+  "      <placeholder name=\"ColumnItems\" />"
+  "    </menu>"
   "    <menuitem name=\"Home\" action=\"HomeAction\" />"
   "    <menuitem name=\"Print\" action=\"PrintAction\" />"
   "    <menuitem name=\"Quit\" action=\"QuitAction\" />"
@@ -197,6 +563,7 @@ define_menu(void)
 
   static GtkActionEntry entries[] = {
     /* name, stock id, label, accelerator, tooltip, callback */
+    { "ColumnsMenuAction", NULL, _("_Columns"), NULL, NULL, NULL },
     { "HomeAction", NULL, _("Visit _Home Page"), NULL,
       _("open the jvqplot homepage in a web browser"),
       G_CALLBACK(home_action) },
@@ -206,11 +573,19 @@ define_menu(void)
       _("quit the program"), G_CALLBACK(quit_cb) }
   };
   static guint n_entries = G_N_ELEMENTS (entries);
+  GtkToggleActionEntry toggle_entries[] = {
+    /* name, stock id, label, accelerator, tooltip, callback, active */
+    { "StatsAction", NULL, _("Show _Statistics"), "<control>I",
+      _("show performance counters"), G_CALLBACK(stats_action),
+      state->stats.show }
+  };
 
   GtkActionGroup *action_group = gtk_action_group_new("jvqplot");
   gtk_action_group_add_actions(action_group, entries, n_entries, NULL);
+  gtk_action_group_add_toggle_actions(action_group, toggle_entries,
+                                      G_N_ELEMENTS(toggle_entries), NULL);
 
-  GtkUIManager *menu_manager = gtk_ui_manager_new();
+  menu_manager = gtk_ui_manager_new();
   gtk_ui_manager_insert_action_group (menu_manager, action_group, 0);
   gtk_ui_manager_add_ui_from_string(menu_manager, menu_def, -1, &err);
   if (err) {
@@ -227,19 +602,65 @@ define_menu(void)
                    G_CALLBACK(popup_cb), popup_menu);
 }
 
+static void
+screen_resolution(double *xres, double *yres)
+{
+  GdkScreen *screen = gdk_screen_get_default();
+  *xres = gdk_screen_get_width(screen)/gdk_screen_get_width_mm(screen)*25.4;
+  *yres = gdk_screen_get_height(screen)/gdk_screen_get_height_mm(screen)*25.4;
+  if (*xres < 50 || *xres > 350 || *yres < 50 || *yres > 350) {
+    *xres = *yres = 100;
+  }
+}
+
 int
 main(int argc, char **argv)
 {
   GError *err = NULL;
   gboolean gui;
+  int i;
 
   gboolean version_flag = FALSE;
+  gboolean nearest = FALSE;
+  gboolean time_x = FALSE;
+  gboolean poll_flag = FALSE;
+  gboolean stats_flag = FALSE;
+  gchar *stats_file = NULL;
+  gchar *columns = NULL;
+  int memory = 0;
+  int history = 0;
+  gchar *record = NULL;
+  gchar *record_size = NULL;
+  gchar *trace_file = NULL;
   GOptionEntry entries[] = {
     { "version", 'v', 0, G_OPTION_ARG_NONE, &version_flag,
       "Show version information", NULL },
+    { "columns", 'c', 0, G_OPTION_ARG_STRING, &columns,
+      "Only show the value columns in LIST, e.g. \"2,4-6\"", "LIST" },
+    { "memory", 'm', 0, G_OPTION_ARG_INT, &memory,
+      "Keep at most MB megabytes of data, reducing larger files", "MB" },
+    { "history", 0, 0, G_OPTION_ARG_INT, &history,
+      "Show the data of the last N reloads faded", "N" },
+    { "nearest", 'n', 0, G_OPTION_ARG_NONE, &nearest,
+      "Do not average matrix entries when showing wide data files", NULL },
+    { "time", 't', 0, G_OPTION_ARG_NONE, &time_x,
+      "Label the x-axis as time, for seconds since 1970", NULL },
+    { "poll", 'p', 0, G_OPTION_ARG_NONE, &poll_flag,
+      "Check the data files for changes by polling", NULL },
+    { "record", 'r', 0, G_OPTION_ARG_FILENAME, &record,
+      "Write every new version of the plot to FILE.png or FILE.raw",
+      "FILE" },
+    { "record-size", 0, 0, G_OPTION_ARG_STRING, &record_size,
+      "Record frames of WxH pixels, default 800x600", "WxH" },
+    { "stats", 's', 0, G_OPTION_ARG_NONE, &stats_flag,
+      "Show performance counters and write them to stderr", NULL },
+    { "stats-file", 0, 0, G_OPTION_ARG_FILENAME, &stats_file,
+      "Write performance counters to FILE", "FILE" },
+    { "trace", 0, 0, G_OPTION_ARG_FILENAME, &trace_file,
+      "Write a timeline of the work done to FILE", "FILE" },
     { NULL, '\0', 0, 0, NULL, NULL, NULL }
   };
-  gui = gtk_init_with_args(&argc, &argv, "datafile", entries, NULL, &err);
+  gui = gtk_init_with_args(&argc, &argv, "datafile...", entries, NULL, &err);
   if (err) {
     fprintf(stderr, "%s\n", err->message);
     g_clear_error(&err);
@@ -263,39 +684,114 @@ main(int argc, char **argv)
   if (argc<2) {
     fprintf(stderr, "error: no data file given\n");
     exit(1);
-  } else if (argc>2) {
-    fprintf(stderr, "error: too many arguments\n");
+  }
+
+  state = new_state();
+  screen_resolution(&state->xres, &state->yres);
+  state->matrix_nearest = nearest;
+  state->time_x = time_x;
+  state->memory_budget = (gsize)MAX(memory, 0) << 20;
+  state->history = MAX(history, 0);
+  if (columns && ! parse_columns(&state->columns, columns, &err)) {
+    fprintf(stderr, "error: %s\n", err->message);
+    g_clear_error(&err);
     exit(1);
   }
+  if (stats_file) {
+    state->stats.out = fopen(stats_file, "w");
+    if (! state->stats.out) {
+      fprintf(stderr, "error: cannot open \"%s\"\n", stats_file);
+      exit(1);
+    }
+    state->stats.enabled = TRUE;
+  } else if (stats_flag) {
+    state->stats.enabled = TRUE;
+    state->stats.out = stderr;
+    state->stats.show = TRUE;
+  }
 
-  GFile *data_file = g_file_new_for_commandline_arg(argv[1]);
-  read_data(data_file);
-  GFileMonitor *monitor = g_file_monitor(data_file, 0, NULL, &err);
-  g_object_unref(data_file);
-  if (err) {
-    fprintf(stderr, "error: cannot monitor file: %s\n", err->message);
+  if (trace_file && ! trace_start(trace_file, &err)) {
+    fprintf(stderr, "error: %s\n", err->message);
     g_clear_error(&err);
     exit(1);
   }
-  g_signal_connect(monitor, "changed", G_CALLBACK(data_changed_cb), NULL);
+  if (record) {
+    int width = 800, height = 600;
+    char end;
+    if (record_size && (sscanf(record_size, "%dx%d%c",
+                               &width, &height, &end) != 2
+                        || width < 1 || height < 1)) {
+      fprintf(stderr, "error: invalid frame size \"%s\"\n", record_size);
+      exit(1);
+    }
+    recorder = start_recording(record, width, height, &err);
+    if (! recorder) {
+      fprintf(stderr, "error: %s\n", err->message);
+      g_clear_error(&err);
+      exit(1);
+    }
+  }
+
+  n_files = argc-1;
+  for (i=0; i<n_files; ++i) {
+    GFile *data_file = g_file_new_for_commandline_arg(argv[i+1]);
+    add_source(state, data_file);
+    g_object_unref(data_file);
+  }
+  monitor = g_new(GFileMonitor *, n_files);
+  for (i=0; i<n_files; ++i) {
+    monitor[i] = watch_file(state, i, poll_flag, data_reloaded, NULL,
+                            &err);
+    if (! monitor[i]) {
+      fprintf(stderr, "error: cannot monitor \"%s\": %s\n",
+              argv[i+1], err->message);
+      g_clear_error(&err);
+      exit(1);
+    }
+    /* the window opens at once, large files are shown as a preview
+     * with about one row per pixel column first */
+    watch_load(monitor[i], gdk_screen_width());
+  }
 
   window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
   gtk_window_set_default_size(GTK_WINDOW(window), 800, 600);
-  gchar *window_title = g_strconcat("jvqplot: ", argv[1], NULL);
+  gchar *files = g_strjoinv(" ", argv+1);
+  gchar *window_title = g_strconcat("jvqplot: ", files, NULL);
+  g_free(files);
   gtk_window_set_title(GTK_WINDOW(window), window_title);
   g_free(window_title);
   g_signal_connect(window, "destroy", G_CALLBACK(quit_cb), NULL);
+  g_signal_connect(window, "map-event", G_CALLBACK(map_cb), NULL);
+  g_signal_connect(window, "unmap-event", G_CALLBACK(map_cb), NULL);
+  g_signal_connect(window, "window-state-event",
+                   G_CALLBACK(window_state_cb), NULL);
 
   drawing_area = gtk_drawing_area_new();
   gtk_widget_set_size_request(drawing_area, 100, 100);
   g_signal_connect(G_OBJECT(drawing_area), "expose_event",
                    G_CALLBACK(expose_event_callback), NULL);
+  gtk_widget_add_events(drawing_area, GDK_VISIBILITY_NOTIFY_MASK);
+  g_signal_connect(drawing_area, "visibility-notify-event",
+                   G_CALLBACK(visibility_cb), NULL);
   gtk_container_add(GTK_CONTAINER(window), drawing_area);
 
   define_menu();
+  update_column_menu();
 
   gtk_widget_show_all(window);
   gtk_main();
 
+  if (recorder) {
+    int frames, dropped;
+    if (record_id) g_source_remove(record_id);
+    if (! stop_recording(recorder, &frames, &dropped)) {
+      fprintf(stderr, "error: cannot write \"%s\"\n", record);
+    }
+    fprintf(stderr, "recorded %d frames, %d dropped\n", frames, dropped);
+  }
+  for (i=0; i<n_files; ++i) g_object_unref(monitor[i]);
+  g_free(monitor);
+  delete_state(state);
+  if (trace_file) trace_stop();
   return 0;
 }
@@ -1,4 +1,4 @@
-/* jvqplot.h - common header file for jvqplot
+/* jvqplot.h - internal header file for jvqplot and libjvqplot
  *
  * Copyright (C) 2012  Jochen Voss.
  *
@@ -19,23 +19,209 @@
 #ifndef FILE_JVQPLOT_H_SEEN
 #define FILE_JVQPLOT_H_SEEN
 
+#include <stdio.h>              /* for 'FILE' */
+
 #include <cairo.h>              /* for 'cairo_t' */
 #include <gio/gio.h>            /* for 'GFile' */
 
 
+/* This header is private to the programs of this package; other
+ * programs use the library through "libjvqplot.h".
+ *
+ * All functions operate on an explicit `struct state', which holds
+ * the data of one plot together with all cached results.  Different
+ * states can be used concurrently from different threads, but each
+ * state must only be used by one thread at a time.  */
+
+
+/* from "stats.c" */
+#define FPS_FRAMES 32
+enum stage {
+  STAGE_OPEN, STAGE_PARSE, STAGE_UPDATE, STAGE_LAYOUT, STAGE_DRAW,
+  N_STAGES
+};
+struct stats {
+  gboolean enabled;             /* write the counters to `out' */
+  gboolean show;                /* show the counters on screen */
+  FILE *out;
+  gint64 start[N_STAGES], usec[N_STAGES];
+  gint64 frame_time[FPS_FRAMES];
+  int n_frames;
+  double points_submitted, points_drawn;
+  double points_stroked;        /* total, updated by draw_data() */
+  int events, events_coalesced;
+  int datasets_reused;          /* unchanged datasets in the last reload */
+  int layers, layers_drawn;     /* in the last frame, see draw_graph() */
+};
+struct state;
+extern const char *const stage_name[N_STAGES];
+extern void stats_start(struct state *state, enum stage stage);
+extern void stats_stop(struct state *state, enum stage stage);
+extern double stats_fps(struct state *state);
+extern void stats_reload_done(struct state *state);
+extern void stats_frame_done(struct state *state,
+                             double submitted, double drawn);
+
+
 /* from "data.c" */
+struct columns {
+  int len;
+  gboolean *hidden;             /* for the file columns 0, ..., len-1 */
+  gboolean hide_rest;           /* whether the remaining columns are hidden */
+};
 struct dataset {
   double *data;
   int rows, cols;
+  int stable_rows;              /* rows unchanged since last generation */
+  int color;                    /* colour index of the first value column */
+  double min[2], max[2];        /* range of the x- and y-values */
+
+  /* the bytes the dataset was read from, to detect changes */
+  gsize length;
+  guint64 hash;
+  gboolean ends_line;           /* the last row ends with a newline */
+  int file_cols;                /* number of columns in the file */
+  gboolean time;                /* column 0 holds ISO 8601 timestamps */
+  gchar delim;                  /* ',', ';', or ' ' for spaces and tabs */
+  GBytes *names;                /* column names from a header row */
+  gsize *offset;                /* row offsets, if columns are hidden */
+  const struct columns *columns; /* the columns which were read */
+  struct reduction *reduction;  /* set if rows were dropped */
 };
-struct state {
+struct source {
+  GFile *file;
   int dataset_used;
   struct dataset *dataset;
+  struct columns *columns;      /* the columns read for `dataset' */
+  gchar *message;
+  int progress;                 /* per mille while loading, or -1 */
+  gboolean preview;             /* `dataset' only holds a sample */
+
+  /* for files read in streaming mode, a file offset where reading
+   * can restart, the number of (decompressed) bytes from there to the
+   * end of the last data row, and a hash of the bytes before `tail' */
+  gsize tail, tail_skip;
+  guint64 tail_hash;
+};
+/* With a history, the data replaced by a reload is kept as a ghost,
+ * which is drawn faded behind the current data.  As long as the rows
+ * of a ghost are unchanged at the start of the current dataset, for
+ * example when the file only grew, the ghost shares them and `data'
+ * is NULL.  Only once they change, the ghost gets its own copy.  */
+struct ghost {
+  int source, dataset;          /* the dataset the rows are shared with */
+  int age;                      /* reloads of the source since */
+  int rows, cols;
+  int *color;                   /* the colour index of every column */
+  double *data;                 /* own copy of the rows, or NULL */
+  double min[2], max[2];
+};
+struct state {
+  int source_used;
+  struct source *source;
+  int dataset_used;             /* the datasets of all sources */
+  struct dataset *dataset;
+  unsigned generation;          /* incremented whenever the data changes */
   double min[2], max[2];
+  gboolean matrix;              /* show the data as a matrix image */
+  gboolean reduced;             /* rows were dropped to save memory */
+  gboolean time_axis;           /* the x-values are seconds since 1970 */
+  double zmin, zmax;            /* value range, in matrix mode */
   gchar *message;
+  int ghost_used;               /* earlier data, oldest first */
+  struct ghost *ghost;
+
+  /* settings */
+  double xres, yres;            /* screen resolution, for messages */
+  gboolean matrix_nearest;      /* don't average matrix entries */
+  struct columns columns;       /* the columns to read on the next load */
+  gsize memory_budget;          /* bytes for the data of all files, or 0 */
+  gboolean time_x;              /* label numeric x-values as times, too */
+  int history;                  /* number of reloads shown as ghosts */
+
+  struct stats stats;
+  struct density_cache *density_cache;
+  struct matrix_cache *matrix_cache;
+  struct layer_cache *layer_cache;
 };
-extern struct state *state;
-extern void read_data(GFile *file);
+extern struct state *new_state(void);
+extern void delete_state(struct state *state);
+extern int add_source(struct state *state, GFile *file);
+extern gsize dataset_bytes(struct dataset *ds);
+extern gboolean column_hidden(const struct columns *sel, int c);
+extern void set_column_hidden(struct columns *sel, int c, gboolean hidden);
+extern gboolean parse_columns(struct columns *sel, const gchar *spec,
+                              GError **err);
+extern int dataset_column(const struct dataset *ds, int j);
+extern const gchar *column_name(const struct dataset *ds, int j);
+extern const double *ghost_data(struct state *state,
+                                const struct ghost *g);
+
+/* load_data() can be called from any thread, install_data() must be
+ * called by the thread owning the state.  If `prev' is given,
+ * datasets whose bytes did not change share their data with `prev',
+ * so `prev' must not change until the load is installed.  Only the
+ * columns selected by `sel' are read, NULL selects all columns.  If
+ * the data needs more than `budget' bytes, rows are reduced, see
+ * "reduce.c"; a budget of 0 means no limit.  If `progress' is not
+ * NULL, it is updated atomically with the per mille of the file
+ * processed so far.
+ *
+ * If `samples' is not 0, load_data_async() first calls `done' with
+ * previews of large files, made from `samples' and then 16*`samples'
+ * rows spread evenly over the file; load_is_preview() is TRUE for
+ * these.  The full data is passed to `done' last.  */
+struct load;
+typedef void (*load_done_func)(struct load *load, gpointer data);
+extern struct load *load_data(GFile *file, const struct source *prev,
+                              const struct columns *sel, gsize budget,
+                              gint *progress);
+extern gboolean load_is_preview(struct load *load);
+extern void delete_load(struct load *load);
+extern void install_data(struct state *state, int source, struct load *load);
+extern void show_progress(struct state *state, int source, int progress);
+extern void read_data(struct state *state, int source);
+extern void read_all(struct state *state);
+extern void load_data_async(GFile *file, const struct source *prev,
+                            const struct columns *sel, gsize budget,
+                            int samples, gint *progress,
+                            load_done_func done, gpointer data);
+
+
+/* from "reduce.c" */
+extern void reduce_start(struct dataset *ds, int max_rows);
+extern void reduce_add(struct dataset *ds);
+extern void reduce_finish(struct dataset *ds);
+extern gint64 rows_read(const struct dataset *ds);
+extern struct reduction *copy_reduction(const struct reduction *r);
+extern void free_reduction(struct reduction *r);
+
+
+/* from "decompress.c" */
+enum compression { COMPRESSION_NONE, COMPRESSION_GZIP, COMPRESSION_ZSTD };
+struct decoder;
+extern enum compression detect_compression(GInputStream *in);
+extern struct decoder *start_decoder(GInputStream *in,
+                                     enum compression compression,
+                                     goffset offset);
+extern GBytes *decoder_next(struct decoder *d, goffset *frame);
+extern goffset decoder_tell(struct decoder *d);
+extern gboolean finish_decoder(struct decoder *d, gboolean *truncated,
+                               GError **err);
+
+
+/* from "timestamp.c" */
+extern gboolean is_timestamp(const gchar *s, gsize len);
+extern gboolean parse_timestamp(const gchar *s, gsize len, double *t);
+extern void format_time(double t, double step, gchar *buffer, gsize size);
+
+
+/* from "trace.c" */
+extern gboolean trace_start(const gchar *path, GError **err);
+extern void trace_stop(void);
+extern gint64 trace_begin(void);
+extern void trace_end(gint64 begin, const char *name,
+                      const char *key, gint64 value);
 
 
 /* from "layout.c" */
@@ -44,17 +230,92 @@ struct layout {
   double ax, ay, bx, by;
   double dx, dy;
   int xmult, ymult;
+  gboolean time_x;              /* the x-values are seconds since 1970 */
 };
 extern struct layout *new_layout(int w_pix, int h_pix,
                                  double xres, double yres,
                                  double xmin, double xmax,
-                                 double ymin, double ymax);
+                                 double ymin, double ymax,
+                                 gboolean time_x);
 extern void delete_layout(struct layout *L);
 
 
+/* from "density.c" */
+extern gboolean use_density(struct state *state, struct layout *L);
+extern cairo_surface_t *density_image(struct state *state, struct layout *L,
+                                      double r, double g, double b);
+extern cairo_surface_t *scaled_density_image(struct state *state,
+                                             struct layout *L,
+                                             double scale,
+                                             double r, double g, double b);
+extern void delete_density_cache(struct density_cache *cache);
+
+
+/* from "matrix.c" */
+extern cairo_surface_t *matrix_image(struct state *state, struct layout *L);
+extern void delete_matrix_cache(struct matrix_cache *cache);
+
+
+/* from "monitor.c" */
+typedef void (*reload_func)(gpointer data);
+extern GFileMonitor *watch_file(struct state *state, int source,
+                                gboolean force_poll,
+                                reload_func callback, gpointer data,
+                                GError **err);
+extern void watch_reload(GFileMonitor *monitor);
+extern void watch_load(GFileMonitor *monitor, int samples);
+extern void watch_hold(GFileMonitor *monitor, gboolean hold);
+extern gboolean watch_is_waiting(GFileMonitor *monitor);
+extern void watch_pause(GFileMonitor *monitor, gboolean paused);
+
+
+/* from "serve.c" */
+extern gboolean serve_plots(const gchar *socket_path, gsize budget,
+                            int dpi, int max_threads, GError **err);
+
+
+/* from "record.c" */
+struct recorder;
+extern struct recorder *start_recording(const gchar *name,
+                                        int width, int height, GError **err);
+extern gboolean record_frame(struct recorder *rec, struct state *state);
+extern void drop_frame(struct recorder *rec);
+extern gboolean stop_recording(struct recorder *rec,
+                               int *frames, int *dropped);
+
+
 /* from "draw.c" */
-extern double xres, yres;
-extern void draw_graph(cairo_t *cr, struct layout *L, gboolean is_screen);
+struct draw_pos {
+  int k, j, pass, row;
+  cairo_surface_t *halo;        /* see draw_data() */
+};
+extern double draw_cost(struct state *state, struct layout *L);
+extern void draw_background(struct state *state, cairo_t *cr,
+                            struct layout *L, gboolean is_screen);
+extern gboolean draw_data(struct state *state, cairo_t *cr,
+                          struct layout *L, int stride,
+                          struct draw_pos *pos, gint64 deadline);
+extern void clear_draw_pos(struct draw_pos *pos);
+extern void draw_legend(struct state *state, cairo_t *cr, struct layout *L);
+extern void draw_message(struct state *state, cairo_t *cr,
+                         gboolean is_screen);
+extern void draw_stats(struct state *state, cairo_t *cr, struct layout *L);
+extern void draw_graph(struct state *state, cairo_t *cr, struct layout *L,
+                       gboolean is_screen);
+extern void delete_layer_cache(struct layer_cache *cache);
+struct vector_plot;
+extern struct vector_plot *decimate_data(struct state *state,
+                                         struct layout *L, double scale,
+                                         gint *progress);
+extern void delete_vector_plot(struct vector_plot *plot);
+extern void draw_vector_graph(struct state *state, cairo_t *cr,
+                              struct layout *L, struct vector_plot *plot);
+extern cairo_status_t write_vector_plot(struct state *state,
+                                        const gchar *format,
+                                        double width, double height,
+                                        double dpi,
+                                        cairo_write_func_t write,
+                                        void *closure);
 
 
 #endif /* FILE_JVQPLOT_H_SEEN */
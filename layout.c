@@ -72,6 +72,34 @@ stepsize(double w, int *mult_ret)
   return  size;
 }
 
+static double
+time_stepsize(double w, int *mult_ret)
+/* Like stepsize(), but for times in seconds: the major ticks fall on
+ * whole seconds, minutes, hours or days.  */
+{
+  static const struct {
+    double major;
+    int mult;
+  } steps[] = {
+    { 1, 5 }, { 2, 4 }, { 5, 5 }, { 10, 5 }, { 15, 3 }, { 30, 3 },
+    { 60, 4 }, { 120, 4 }, { 300, 5 }, { 600, 5 }, { 900, 3 },
+    { 1800, 3 }, { 3600, 4 }, { 7200, 4 }, { 10800, 3 }, { 21600, 3 },
+    { 43200, 4 }, { 86400, 4 }, { 172800, 4 }, { 604800, 7 },
+    { 1209600, 7 },
+  };
+  gsize i;
+
+  if (w < steps[0].major/steps[0].mult) return stepsize(w, mult_ret);
+  for (i=0; i<G_N_ELEMENTS(steps); ++i) {
+    double size = steps[i].major/steps[i].mult;
+    if (size > w) {
+      *mult_ret = steps[i].mult;
+      return size;
+    }
+  }
+  return stepsize(w/86400, mult_ret) * 86400;
+}
+
 static void
 normalize(double a, double b, double d, double *aa, double *bb)
 /* Input is an interval `[a;b]' and a tick distance `d'.  The function
@@ -88,8 +116,11 @@ normalize(double a, double b, double d, double *aa, double *bb)
 
 struct layout *
 new_layout(int w_pix, int h_pix, double xres, double yres,
-           double xmin, double xmax, double ymin, double ymax)
+           double xmin, double xmax, double ymin, double ymax,
+           gboolean time_x)
 {
+  gint64 trace = trace_begin();
+
   /* physical layout dimensions */
   double w_phys = w_pix/xres;
   double h_phys = h_pix/yres;
@@ -103,7 +134,11 @@ new_layout(int w_pix, int h_pix, double xres, double yres,
   double n_ylab = (h_phys-tgap_phys-bgap_phys)*2.54;
   double x0, x1, dx, y0, y1, dy, xscale, yscale, dz, scale;
   int xmult, ymult;
-  dx = stepsize((xmax-xmin)/n_xlab, &xmult);
+  if (time_x) {
+    dx = time_stepsize((xmax-xmin)/n_xlab, &xmult);
+  } else {
+    dx = stepsize((xmax-xmin)/n_xlab, &xmult);
+  }
   dy = stepsize((ymax-ymin)/n_ylab, &ymult);
 
   /* check whether 1:1 aspect ratio is acceptable */
@@ -113,7 +148,8 @@ new_layout(int w_pix, int h_pix, double xres, double yres,
   xscale = (w_phys-lgap_phys-rgap_phys) / (x1-x0);
   yscale = (h_phys-tgap_phys-bgap_phys) / (y1-y0);
   scale = MIN(xscale, yscale);
-  if (scale*(xmax-xmin) >= .6*w_phys && scale*(ymax-ymin) >= .2*h_phys) {
+  if (! time_x
+      && scale*(xmax-xmin) >= .6*w_phys && scale*(ymax-ymin) >= .2*h_phys) {
     /* yes, we can use 1:1 */
     if (dx >= dy) {
       dy = dx;
@@ -141,11 +177,13 @@ new_layout(int w_pix, int h_pix, double xres, double yres,
   L->bx = (xpos - x0*xscale)*xres;
   L->dx = dx;
   L->xmult = xmult;
+  L->time_x = time_x;
   L->ay = -yscale*yres;
   L->by = h_pix - (ypos - y0*yscale)*yres;
   L->dy = dy;
   L->ymult = ymult;
 
+  trace_end(trace, "layout", NULL, 0);
   return L;
 }
 
@@ -0,0 +1,129 @@
+/* libjvqplot.c - public interface of the jvqplot library
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+
+#include "libjvqplot.h"
+#include "jvqplot.h"
+
+
+/* Only the functions of this file are exported from the shared
+ * library.  The programs of this package link the internal functions
+ * statically, so that "jvqplot.h" can change without breaking other
+ * users of the library.  */
+
+struct jvqplot {
+  struct state *state;
+};
+
+
+struct jvqplot *
+jvqplot_new(void)
+{
+  struct jvqplot *plot = g_new(struct jvqplot, 1);
+
+  plot->state = new_state();
+  return plot;
+}
+
+void
+jvqplot_free(struct jvqplot *plot)
+{
+  if (! plot) return;
+  delete_state(plot->state);
+  g_free(plot);
+}
+
+void
+jvqplot_add_file(struct jvqplot *plot, GFile *file)
+{
+  add_source(plot->state, file);
+}
+
+gboolean
+jvqplot_set_columns(struct jvqplot *plot, const gchar *spec, GError **err)
+{
+  return parse_columns(&plot->state->columns, spec, err);
+}
+
+void
+jvqplot_set_memory_budget(struct jvqplot *plot, gsize bytes)
+{
+  plot->state->memory_budget = bytes;
+}
+
+void
+jvqplot_set_time_axis(struct jvqplot *plot, gboolean time_x)
+{
+  plot->state->time_x = time_x;
+}
+
+void
+jvqplot_read(struct jvqplot *plot)
+{
+  read_all(plot->state);
+}
+
+gboolean
+jvqplot_has_data(struct jvqplot *plot)
+{
+  return plot->state->dataset_used > 0;
+}
+
+const gchar *
+jvqplot_message(struct jvqplot *plot)
+{
+  return plot->state->message;
+}
+
+void
+jvqplot_draw(struct jvqplot *plot, cairo_t *cr, int width, int height)
+{
+  struct state *state = plot->state;
+
+  if (! state->dataset_used) {
+    cairo_save(cr);
+    cairo_rectangle(cr, 0, 0, width, height);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_fill(cr);
+    cairo_restore(cr);
+    return;
+  }
+
+  struct layout *L = new_layout(width, height, state->xres, state->yres,
+                                state->min[0], state->max[0],
+                                state->min[1], state->max[1],
+                                state->time_axis);
+  draw_graph(state, cr, L, FALSE);
+  delete_layout(L);
+}
+
+cairo_status_t
+jvqplot_write_vector(struct jvqplot *plot, const gchar *format,
+                     double width, double height, double dpi,
+                     cairo_write_func_t write, void *closure)
+{
+  g_return_val_if_fail(plot->state->dataset_used > 0,
+                       CAIRO_STATUS_INVALID_SIZE);
+  return write_vector_plot(plot->state, format, width, height, dpi,
+                           write, closure);
+}
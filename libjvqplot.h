@@ -0,0 +1,71 @@
+/* libjvqplot.h - public interface of the jvqplot library
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_LIBJVQPLOT_H_SEEN
+#define FILE_LIBJVQPLOT_H_SEEN
+
+#include <cairo.h>              /* for 'cairo_t' */
+#include <gio/gio.h>            /* for 'GFile' */
+
+G_BEGIN_DECLS
+
+
+/* A `struct jvqplot' holds the data files of one plot together with
+ * the data read from them.  Different plots can be used concurrently
+ * from different threads, but each plot must only be used by one
+ * thread at a time.  The contents of the struct are private.  */
+struct jvqplot;
+
+extern struct jvqplot *jvqplot_new(void);
+extern void jvqplot_free(struct jvqplot *plot);
+
+/* Settings take effect when the files are read next.  The column list
+ * has the form "2,4-6", counting from 1; only the listed columns are
+ * shown.  A memory budget of 0 means no limit.  */
+extern void jvqplot_add_file(struct jvqplot *plot, GFile *file);
+extern gboolean jvqplot_set_columns(struct jvqplot *plot, const gchar *spec,
+                                    GError **err);
+extern void jvqplot_set_memory_budget(struct jvqplot *plot, gsize bytes);
+extern void jvqplot_set_time_axis(struct jvqplot *plot, gboolean time_x);
+
+/* Read all files, using several threads.  Files which did not change
+ * since the last call are not parsed again.  Problems with the files
+ * are reported by jvqplot_message(), which returns NULL if there are
+ * none.  */
+extern void jvqplot_read(struct jvqplot *plot);
+extern gboolean jvqplot_has_data(struct jvqplot *plot);
+extern const gchar *jvqplot_message(struct jvqplot *plot);
+
+/* Draw the plot into the rectangle from (0, 0) to (`width', `height')
+ * of `cr', or write it as a "pdf" or "svg" file of `width' times
+ * `height' points, with the lines reduced to `dpi' dots per inch.
+ * Without data, jvqplot_draw() only paints the background and
+ * jvqplot_write_vector() fails.  */
+extern void jvqplot_draw(struct jvqplot *plot, cairo_t *cr,
+                         int width, int height);
+extern cairo_status_t jvqplot_write_vector(struct jvqplot *plot,
+                                           const gchar *format,
+                                           double width, double height,
+                                           double dpi,
+                                           cairo_write_func_t write,
+                                           void *closure);
+
+
+G_END_DECLS
+
+#endif /* FILE_LIBJVQPLOT_H_SEEN */
@@ -0,0 +1,263 @@
+/* matrix.c - show wide data files as a colour coded matrix
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+#include <math.h>
+
+#include <glib.h>
+#include <cairo.h>
+
+#include "jvqplot.h"
+
+
+static const struct {
+  double r, g, b;
+} stops[] = {
+  { 0.267004, 0.004874, 0.329415 },
+  { 0.229739, 0.322361, 0.545706 },
+  { 0.127568, 0.566949, 0.550556 },
+  { 0.369214, 0.788888, 0.382914 },
+  { 0.993248, 0.906157, 0.143936 },
+};
+static guint32 colormap[256];
+static gsize colormap_initialised = 0;
+
+
+/* Row i of a data set covers the x-range of width x[i]-x[i-1],
+ * centred at x[i].  Since this only depends on earlier rows,
+ * appended rows never change the pixels of existing ones.  The cache
+ * holds the sum and the number of matrix entries per pixel.  */
+struct matrix_cache {
+  int width, height;
+  double ax, bx, ay, by;
+  unsigned generation;
+  int dataset_used;
+  int *rows;                    /* number of rows added, per dataset */
+  int cols;
+  int *ylo, *yhi;               /* pixel rows covered by each column */
+  double *sum;
+  guint32 *count;
+  cairo_surface_t *image;
+};
+
+
+static void
+init_colormap(void)
+{
+  int n = G_N_ELEMENTS(stops) - 1;
+  int i;
+
+  if (! g_once_init_enter(&colormap_initialised)) return;
+
+  for (i=0; i<256; ++i) {
+    double t = i/255.0*n;
+    int k = MIN((int)t, n-1);
+    double s = t - k;
+    double r = (1-s)*stops[k].r + s*stops[k+1].r;
+    double g = (1-s)*stops[k].g + s*stops[k+1].g;
+    double b = (1-s)*stops[k].b + s*stops[k+1].b;
+    colormap[i] = 0xff000000 | (guint32)(255*r + .5)<<16
+      | (guint32)(255*g + .5)<<8 | (guint32)(255*b + .5);
+  }
+  g_once_init_leave(&colormap_initialised, 1);
+}
+
+static gboolean
+same_layout(struct matrix_cache *cache, struct layout *L)
+{
+  return cache->width == L->width && cache->height == L->height
+    && cache->ax == L->ax && cache->bx == L->bx
+    && cache->ay == L->ay && cache->by == L->by;
+}
+
+static void
+reset_cache(struct state *state, struct layout *L)
+{
+  struct matrix_cache *cache = state->matrix_cache;
+  int n = L->width * L->height;
+  int cols = 0;
+  int j, k;
+
+  if (cache->width != L->width || cache->height != L->height) {
+    g_free(cache->sum);
+    g_free(cache->count);
+    cache->sum = g_new(double, n);
+    cache->count = g_new(guint32, n);
+    if (cache->image) cairo_surface_destroy(cache->image);
+    cache->image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                              L->width, L->height);
+  }
+  memset(cache->sum, 0, n * sizeof(double));
+  memset(cache->count, 0, n * sizeof(guint32));
+  cache->width = L->width;
+  cache->height = L->height;
+  cache->ax = L->ax;
+  cache->bx = L->bx;
+  cache->ay = L->ay;
+  cache->by = L->by;
+  cache->dataset_used = 0;
+
+  for (k=0; k<state->dataset_used; ++k) {
+    if (state->dataset[k].cols > cols) cols = state->dataset[k].cols;
+  }
+  cache->cols = cols;
+  cache->ylo = g_renew(int, cache->ylo, cols);
+  cache->yhi = g_renew(int, cache->yhi, cols);
+  for (j=1; j<cols; ++j) {
+    /* L->ay is negative */
+    int lo = floor(L->ay*(j+.5) + L->by);
+    int hi = floor(L->ay*(j-.5) + L->by);
+    if (hi <= lo) hi = lo+1;
+    cache->ylo[j] = CLAMP(lo, 0, L->height);
+    cache->yhi[j] = CLAMP(hi, 0, L->height);
+  }
+}
+
+static gboolean
+cache_is_appendable(struct state *state, struct layout *L)
+{
+  struct matrix_cache *cache = state->matrix_cache;
+  int k;
+
+  if (! same_layout(cache, L) || cache->generation+1 != state->generation)
+    return FALSE;
+  if (cache->dataset_used > state->dataset_used)
+    return FALSE;
+  for (k=0; k<state->dataset_used; ++k) {
+    if (state->dataset[k].cols > cache->cols)
+      return FALSE;
+    if (k < cache->dataset_used
+        && state->dataset[k].stable_rows < cache->rows[k])
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static void
+add_rows(struct state *state, struct layout *L, struct dataset *ds, int from)
+{
+  struct matrix_cache *cache = state->matrix_cache;
+  int w = L->width;
+  int cols = ds->cols;
+  double *data = ds->data;
+  int i, j, px, py;
+
+  for (i=from; i<ds->rows; ++i) {
+    double *row = data + (gsize)i*cols;
+    double x = row[0];
+    double d = 1;
+    if (i > 0) {
+      d = x - row[-cols];
+    } else if (ds->rows > 1) {
+      d = data[cols] - x;
+    }
+    int lo = floor(L->ax*(x-d/2) + L->bx);
+    int hi = floor(L->ax*(x+d/2) + L->bx);
+    if (hi <= lo) hi = lo+1;
+    lo = CLAMP(lo, 0, w);
+    hi = CLAMP(hi, 0, w);
+
+    for (px=lo; px<hi; ++px) {
+      for (j=1; j<cols; ++j) {
+        double z = row[j];
+        for (py=cache->ylo[j]; py<cache->yhi[j]; ++py) {
+          int idx = py*w + px;
+          if (state->matrix_nearest && cache->count[idx]) continue;
+          cache->sum[idx] += z;
+          cache->count[idx] += 1;
+        }
+      }
+    }
+  }
+}
+
+static void
+colour_pixels(struct state *state)
+{
+  struct matrix_cache *cache = state->matrix_cache;
+  int w = cache->width;
+  int h = cache->height;
+  double z0 = state->zmin;
+  double scale = (state->zmax > z0) ? 255/(state->zmax-z0) : 0;
+  int x, y;
+
+  cairo_surface_flush(cache->image);
+  unsigned char *pixels = cairo_image_surface_get_data(cache->image);
+  int stride = cairo_image_surface_get_stride(cache->image);
+  for (y=0; y<h; ++y) {
+    guint32 *row = (guint32 *)(pixels + y*stride);
+    for (x=0; x<w; ++x) {
+      int idx = y*w + x;
+      if (cache->count[idx] == 0) {
+        row[x] = 0;
+        continue;
+      }
+      double z = cache->sum[idx] / cache->count[idx];
+      int c = (z-z0)*scale + .5;
+      row[x] = colormap[CLAMP(c, 0, 255)];
+    }
+  }
+  cairo_surface_mark_dirty(cache->image);
+}
+
+cairo_surface_t *
+matrix_image(struct state *state, struct layout *L)
+{
+  struct matrix_cache *cache = state->matrix_cache;
+  int k;
+
+  if (! cache) {
+    cache = state->matrix_cache = g_new0(struct matrix_cache, 1);
+    cache->width = -1;
+  }
+  if (cache->generation == state->generation && same_layout(cache, L))
+    return cache->image;
+
+  init_colormap();
+  if (! cache_is_appendable(state, L)) reset_cache(state, L);
+
+  for (k=0; k<state->dataset_used; ++k) {
+    int from = (k < cache->dataset_used) ? cache->rows[k] : 0;
+    add_rows(state, L, &state->dataset[k], from);
+  }
+  cache->rows = g_renew(int, cache->rows, MAX(state->dataset_used, 1));
+  for (k=0; k<state->dataset_used; ++k) {
+    cache->rows[k] = state->dataset[k].rows;
+  }
+  cache->dataset_used = state->dataset_used;
+  cache->generation = state->generation;
+
+  colour_pixels(state);
+  return cache->image;
+}
+
+void
+delete_matrix_cache(struct matrix_cache *cache)
+{
+  g_free(cache->rows);
+  g_free(cache->ylo);
+  g_free(cache->yhi);
+  g_free(cache->sum);
+  g_free(cache->count);
+  if (cache->image) cairo_surface_destroy(cache->image);
+  g_free(cache);
+}
@@ -0,0 +1,435 @@
+/* monitor.c - reload the data when the input file changes
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "jvqplot.h"
+
+
+/* On some file systems, e.g. for writes from other hosts on NFS, the
+ * file monitors of GIO miss changes.  There a poll monitor is used,
+ * which checks the size, modification time and inode of the file
+ * with stat().  The interval between checks is a quarter of the time
+ * since the file last changed, between POLL_MIN and POLL_MAX
+ * milliseconds, so that a file which is being written is checked
+ * often, while an idle file costs one stat() per POLL_MAX.  */
+#define POLL_MIN 20
+#define POLL_MAX 1000
+
+
+struct watch {
+  struct state *state;
+  int source;
+  GFile *file;                  /* the file to reload, NULL if deleted */
+  guint reload_id;
+  gboolean busy;                /* a load is running on the worker pool */
+  gboolean pending;             /* the file changed while loading */
+  gboolean dead;                /* the monitor is gone, free when done */
+  int held;                     /* don't install loads while positive */
+  gboolean paused;              /* only record changes, don't reload */
+  gboolean deferred;            /* the file changed while paused */
+  struct load *held_load;       /* a finished load, waiting for install */
+  int samples;                  /* preview size for the next load, or 0 */
+  gint progress;                /* per mille, written by the worker */
+  guint progress_id;
+  reload_func callback;
+  gpointer data;
+};
+
+
+static gboolean reload_cb(gpointer data);
+static gboolean request_reload(struct watch *w);
+
+
+typedef struct {
+  GFileMonitor parent;
+  GFile *file;
+  gchar *path;
+  gboolean exists;
+  GStatBuf st;
+  gint64 changed;               /* monotonic time of the last change */
+  guint poll_id;
+} PollMonitor;
+typedef GFileMonitorClass PollMonitorClass;
+
+G_DEFINE_TYPE(PollMonitor, poll_monitor, G_TYPE_FILE_MONITOR)
+
+static gboolean poll_cb(gpointer data);
+
+static void
+schedule_poll(PollMonitor *m, gint64 now)
+{
+  gint64 interval = (now - m->changed) / 4000;
+
+  m->poll_id = g_timeout_add(CLAMP(interval, POLL_MIN, POLL_MAX),
+                             poll_cb, m);
+}
+
+static gboolean
+same_file(const GStatBuf *a, const GStatBuf *b)
+{
+  if (a->st_size != b->st_size || a->st_mtime != b->st_mtime
+      || a->st_ino != b->st_ino || a->st_dev != b->st_dev)
+    return FALSE;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  if (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec) return FALSE;
+#endif
+  return TRUE;
+}
+
+static gboolean
+poll_cb(gpointer data)
+{
+  PollMonitor *m = data;
+  GFileMonitor *monitor = G_FILE_MONITOR(m);
+  gint64 now = g_get_monotonic_time();
+  GStatBuf st;
+  GFileMonitorEvent event = G_FILE_MONITOR_EVENT_CHANGED;
+
+  m->poll_id = 0;
+  gboolean exists = g_stat(m->path, &st) == 0;
+  if (exists != m->exists) {
+    event = exists ? G_FILE_MONITOR_EVENT_CREATED
+      : G_FILE_MONITOR_EVENT_DELETED;
+  } else if (! exists || same_file(&st, &m->st)) {
+    schedule_poll(m, now);
+    return FALSE;
+  }
+
+  m->exists = exists;
+  m->st = st;
+  m->changed = now;
+  /* a signal handler may cancel the monitor */
+  g_object_ref(m);
+  g_file_monitor_emit_event(monitor, m->file, NULL, event);
+  if (! g_file_monitor_is_cancelled(monitor)) schedule_poll(m, now);
+  g_object_unref(m);
+  return FALSE;
+}
+
+static gboolean
+poll_monitor_cancel(GFileMonitor *monitor)
+{
+  PollMonitor *m = (PollMonitor *)monitor;
+
+  if (m->poll_id) g_source_remove(m->poll_id);
+  m->poll_id = 0;
+  return TRUE;
+}
+
+static void
+poll_monitor_finalize(GObject *object)
+{
+  PollMonitor *m = (PollMonitor *)object;
+
+  g_object_unref(m->file);
+  g_free(m->path);
+  G_OBJECT_CLASS(poll_monitor_parent_class)->finalize(object);
+}
+
+static void
+poll_monitor_init(PollMonitor *m)
+{
+}
+
+static void
+poll_monitor_class_init(PollMonitorClass *class)
+{
+  G_OBJECT_CLASS(class)->finalize = poll_monitor_finalize;
+  class->cancel = poll_monitor_cancel;
+}
+
+static GFileMonitor *
+poll_file(GFile *file, GError **err)
+{
+  gchar *path = g_file_get_path(file);
+  if (! path) {
+    g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                "only local files can be polled");
+    return NULL;
+  }
+
+  PollMonitor *m = g_object_new(poll_monitor_get_type(), NULL);
+  m->file = g_object_ref(file);
+  m->path = path;
+  m->exists = g_stat(path, &m->st) == 0;
+  /* start slowly, until the file changes */
+  m->changed = g_get_monotonic_time() - 4000*POLL_MAX;
+  schedule_poll(m, g_get_monotonic_time());
+  return G_FILE_MONITOR(m);
+}
+
+static gboolean
+is_remote(GFile *file)
+{
+  GFileInfo *info = g_file_query_filesystem_info(
+                      file, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE, NULL, NULL);
+  gboolean remote = info && g_file_info_get_attribute_boolean(
+                              info, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE);
+  if (info) g_object_unref(info);
+  return remote;
+}
+
+static void
+free_watch_now(struct watch *w)
+{
+  if (w->file) g_object_unref(w->file);
+  g_free(w);
+}
+
+static void
+finish_load(struct watch *w, struct load *load)
+{
+  w->busy = FALSE;
+  if (w->progress_id) {
+    g_source_remove(w->progress_id);
+    w->progress_id = 0;
+  }
+  install_data(w->state, w->source, load);
+  if (w->callback) w->callback(w->data);
+
+  if (w->pending) {
+    w->pending = FALSE;
+    request_reload(w);
+  }
+}
+
+static void
+load_done(struct load *load, gpointer data)
+{
+  struct watch *w = data;
+
+  if (load_is_preview(load)) {
+    /* the load continues in the background */
+    if (w->dead || w->held) {
+      delete_load(load);
+    } else {
+      install_data(w->state, w->source, load);
+      if (w->callback) w->callback(w->data);
+    }
+    return;
+  }
+  if (w->dead) {
+    delete_load(load);
+    free_watch_now(w);
+    return;
+  }
+  if (w->held) {
+    /* the watch stays busy until the load is installed */
+    w->held_load = load;
+    return;
+  }
+  finish_load(w, load);
+}
+
+static gboolean
+progress_cb(gpointer data)
+{
+  struct watch *w = data;
+
+  show_progress(w->state, w->source, g_atomic_int_get(&w->progress));
+  if (w->callback) w->callback(w->data);
+  return TRUE;
+}
+
+static gboolean
+reload_cb(gpointer data)
+{
+  struct watch *w = data;
+  struct state *state = w->state;
+
+  gint64 trace = trace_begin();
+
+  w->reload_id = 0;
+  w->busy = TRUE;
+  w->progress = 0;
+  /* only slow loads show their progress */
+  w->progress_id = g_timeout_add(250, progress_cb, w);
+  load_data_async(w->file, &state->source[w->source], &state->columns,
+                  state->memory_budget / state->source_used,
+                  w->samples, &w->progress, load_done, w);
+  w->samples = 0;
+  trace_end(trace, "start load", NULL, 0);
+  return FALSE;
+}
+
+static gboolean
+request_reload(struct watch *w)
+/* Reload the data once all pending events are processed.  Several
+ * requests in a row only cause one reload, and while the file is
+ * being loaded, further requests are collected for one more reload
+ * afterwards.  While the watch is paused, requests are collected for
+ * one reload when it is resumed.  Returns FALSE if a reload was
+ * already scheduled.  */
+{
+  if (w->paused) {
+    gboolean first = ! w->deferred;
+    w->deferred = TRUE;
+    return first;
+  }
+  if (w->reload_id || w->busy) {
+    if (w->busy) w->pending = TRUE;
+    return FALSE;
+  }
+  w->reload_id = g_idle_add_full(G_PRIORITY_HIGH_IDLE, reload_cb, w, NULL);
+  return TRUE;
+}
+
+static void
+schedule_reload(struct watch *w, GFile *file)
+{
+  struct stats *stats = &w->state->stats;
+
+  stats->events += 1;
+  if (w->file) g_object_unref(w->file);
+  w->file = file ? g_object_ref(file) : NULL;
+  if (! request_reload(w)) stats->events_coalesced += 1;
+}
+
+static void
+data_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                GFileMonitorEvent event_type, gpointer data)
+{
+  struct watch *w = data;
+
+  trace_end(trace_begin(), "file event", "event", event_type);
+  switch (event_type) {
+  case G_FILE_MONITOR_EVENT_CHANGED:
+  case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+  case G_FILE_MONITOR_EVENT_CREATED:
+    schedule_reload(w, file);
+    break;
+  case G_FILE_MONITOR_EVENT_DELETED:
+    schedule_reload(w, NULL);
+    break;
+  default:
+    break;
+  }
+}
+
+static void
+free_watch(gpointer data, GClosure *closure)
+{
+  struct watch *w = data;
+
+  if (w->reload_id) g_source_remove(w->reload_id);
+  if (w->progress_id) g_source_remove(w->progress_id);
+  if (w->held_load) delete_load(w->held_load);
+  if (w->busy && ! w->held_load) {
+    w->dead = TRUE;
+  } else {
+    free_watch_now(w);
+  }
+}
+
+GFileMonitor *
+watch_file(struct state *state, int source, gboolean force_poll,
+           reload_func callback, gpointer data, GError **err)
+/* Files on remote file systems are always polled, other files only
+ * if `force_poll' is set.  */
+{
+  GFile *file = state->source[source].file;
+  GFileMonitor *monitor;
+  if (force_poll || is_remote(file)) {
+    monitor = poll_file(file, err);
+  } else {
+    monitor = g_file_monitor(file, 0, NULL, err);
+  }
+  if (! monitor) return NULL;
+
+  struct watch *w = g_new0(struct watch, 1);
+  w->state = state;
+  w->source = source;
+  w->file = g_object_ref(file);
+  w->callback = callback;
+  w->data = data;
+  g_signal_connect_data(monitor, "changed", G_CALLBACK(data_changed_cb),
+                        w, free_watch, 0);
+  g_object_set_data(G_OBJECT(monitor), "jvqplot-watch", w);
+  return monitor;
+}
+
+void
+watch_reload(GFileMonitor *monitor)
+/* Reload the file without a change notification, e.g. because the
+ * selected columns changed.  */
+{
+  request_reload(g_object_get_data(G_OBJECT(monitor), "jvqplot-watch"));
+}
+
+void
+watch_load(GFileMonitor *monitor, int samples)
+/* Read the file for the first time.  Large files are shown as a
+ * preview with about `samples' rows first, e.g. one row per pixel
+ * column of the window, and then a denser one, while the full data is
+ * read in the background.  */
+{
+  struct watch *w = g_object_get_data(G_OBJECT(monitor), "jvqplot-watch");
+
+  w->samples = samples;
+  request_reload(w);
+}
+
+void
+watch_hold(GFileMonitor *monitor, gboolean hold)
+/* While a watch is held, reloads still run but their data is only
+ * installed once the watch is released, so that the datasets of the
+ * state stay unchanged, e.g. while another thread reads them.  Holds
+ * can be nested.  */
+{
+  struct watch *w = g_object_get_data(G_OBJECT(monitor), "jvqplot-watch");
+
+  w->held += hold ? 1 : -1;
+  if (! w->held && w->held_load) {
+    struct load *load = w->held_load;
+    w->held_load = NULL;
+    finish_load(w, load);
+  }
+}
+
+gboolean
+watch_is_waiting(GFileMonitor *monitor)
+/* Whether newer data was loaded and waits for the watch to be
+ * released.  */
+{
+  struct watch *w = g_object_get_data(G_OBJECT(monitor), "jvqplot-watch");
+
+  return w->held_load != NULL;
+}
+
+void
+watch_pause(GFileMonitor *monitor, gboolean paused)
+/* While a watch is paused, e.g. because nobody can see the plot,
+ * changes of the file are only recorded.  The file is reloaded once
+ * the watch is resumed, continuing from the old data where possible.
+ * A load which is already running is still installed.  */
+{
+  struct watch *w = g_object_get_data(G_OBJECT(monitor), "jvqplot-watch");
+
+  w->paused = paused;
+  if (! paused && w->deferred) {
+    w->deferred = FALSE;
+    request_reload(w);
+  }
+}
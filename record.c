@@ -0,0 +1,259 @@
+/* record.c - write every new version of a plot to an image sequence
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <cairo.h>
+
+#include "jvqplot.h"
+
+
+/* Frames are drawn by the thread owning the state, since the state
+ * can only be used by one thread at a time, but with their own image
+ * caches, so that the caches of the window are not disturbed.  Like
+ * the window, the data is drawn in steps of at most RECORD_BUDGET
+ * microseconds, so that recording does not block the user interface.
+ * Reloads should be held back while a frame is drawn, but not for
+ * long, see drop_frame(); if the data changes before the frame is
+ * finished, the frame is dropped.  Writing the frames, which for PNG
+ * files is mostly compression, is done on a pool of threads.  At most
+ * RECORD_QUEUE frames per thread wait to be written, further frames
+ * are dropped before they are drawn.  */
+#define RECORD_BUDGET 8000
+#define RECORD_QUEUE 2
+
+struct recorder {
+  gchar *prefix;                /* frames are prefix-000001.png, ... */
+  FILE *raw;                    /* or all go into this file */
+  int width, height;
+  int max_pending;
+  unsigned generation;          /* of the last or current frame */
+  int frames, dropped;
+  gint pending;                 /* frames waiting to be written */
+  gint failed;
+  GThreadPool *pool;
+  struct density_cache *density_cache;
+  struct matrix_cache *matrix_cache;
+
+  /* the frame being drawn, if `surface' is set */
+  cairo_surface_t *surface;
+  struct layout *L;
+  struct draw_pos pos;
+};
+
+struct frame {
+  struct recorder *rec;
+  cairo_surface_t *surface;
+  int number;
+};
+
+
+static void
+write_frame(gpointer data, gpointer user_data)
+{
+  struct frame *f = data;
+  struct recorder *rec = f->rec;
+  gint64 trace = trace_begin();
+  gboolean ok;
+
+  if (rec->raw) {
+    /* the pool has one thread, so the frames stay in order */
+    const unsigned char *pixels = cairo_image_surface_get_data(f->surface);
+    int stride = cairo_image_surface_get_stride(f->surface);
+    int y;
+    ok = TRUE;
+    for (y=0; y<rec->height && ok; ++y) {
+      ok = fwrite(pixels + y*stride, 4, rec->width, rec->raw)
+        == (size_t)rec->width;
+    }
+  } else {
+    gchar *name = g_strdup_printf("%s-%06d.png", rec->prefix, f->number);
+    ok = cairo_surface_write_to_png(f->surface, name)
+      == CAIRO_STATUS_SUCCESS;
+    g_free(name);
+  }
+  if (! ok) g_atomic_int_set(&rec->failed, 1);
+  trace_end(trace, "write frame", "frame", f->number);
+
+  cairo_surface_destroy(f->surface);
+  g_free(f);
+  g_atomic_int_add(&rec->pending, -1);
+}
+
+struct recorder *
+start_recording(const gchar *name, int width, int height, GError **err)
+/* If `name' ends in ".raw", all frames are written to this file, as
+ * `height' rows of `width' 32 bit pixels each, in the byte order of
+ * cairo's RGB24 format.  Otherwise `name' must end in ".png", and
+ * every frame is written to its own file, numbered from 1.  */
+{
+  struct recorder *rec = g_new0(struct recorder, 1);
+  int threads = 1;
+
+  rec->width = width;
+  rec->height = height;
+  if (g_str_has_suffix(name, ".raw")) {
+    rec->raw = g_fopen(name, "wb");
+    if (! rec->raw) {
+      int saved = errno;
+      g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(saved),
+                  "cannot open \"%s\": %s", name, g_strerror(saved));
+      g_free(rec);
+      return NULL;
+    }
+  } else if (g_str_has_suffix(name, ".png")) {
+    rec->prefix = g_strndup(name, strlen(name) - 4);
+    threads = MAX(g_get_num_processors() - 1, 1);
+  } else {
+    g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "recordings must end in .png or .raw");
+    g_free(rec);
+    return NULL;
+  }
+  rec->max_pending = RECORD_QUEUE * threads;
+  rec->pool = g_thread_pool_new(write_frame, NULL, threads, FALSE, NULL);
+  return rec;
+}
+
+static void
+swap_caches(struct recorder *rec, struct state *state)
+{
+  struct density_cache *density_cache = state->density_cache;
+  struct matrix_cache *matrix_cache = state->matrix_cache;
+
+  state->density_cache = rec->density_cache;
+  state->matrix_cache = rec->matrix_cache;
+  rec->density_cache = density_cache;
+  rec->matrix_cache = matrix_cache;
+}
+
+static void
+begin_frame(struct recorder *rec, struct state *state)
+{
+  rec->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                                            rec->width, rec->height);
+  rec->L = new_layout(rec->width, rec->height,
+                      state->xres, state->yres,
+                      state->min[0], state->max[0],
+                      state->min[1], state->max[1],
+                      state->time_axis);
+  clear_draw_pos(&rec->pos);
+
+  cairo_t *cr = cairo_create(rec->surface);
+  swap_caches(rec, state);
+  draw_background(state, cr, rec->L, FALSE);
+  swap_caches(rec, state);
+  cairo_destroy(cr);
+}
+
+static void
+end_frame(struct recorder *rec)
+{
+  clear_draw_pos(&rec->pos);
+  delete_layout(rec->L);
+  rec->L = NULL;
+  if (rec->surface) cairo_surface_destroy(rec->surface);
+  rec->surface = NULL;
+}
+
+gboolean
+record_frame(struct recorder *rec, struct state *state)
+/* Draw the plot if the data changed since the last frame.  Returns
+ * TRUE if the frame is not finished yet, and record_frame() must be
+ * called again.  */
+{
+  gint64 start = g_get_monotonic_time();
+
+  if (rec->surface && state->generation != rec->generation) {
+    end_frame(rec);
+    rec->dropped += 1;
+  }
+  if (! rec->surface) {
+    if (! state->dataset_used || state->generation == rec->generation)
+      return FALSE;
+    rec->generation = state->generation;
+    if (g_atomic_int_get(&rec->pending) >= rec->max_pending) {
+      rec->dropped += 1;
+      return FALSE;
+    }
+    begin_frame(rec, state);
+  }
+  gint64 trace = trace_begin();
+
+  cairo_t *cr = cairo_create(rec->surface);
+  gboolean done = draw_data(state, cr, rec->L, 1, &rec->pos,
+                            start+RECORD_BUDGET);
+  if (done) {
+    draw_legend(state, cr, rec->L);
+    draw_message(state, cr, FALSE);
+  }
+  cairo_destroy(cr);
+  if (! done) {
+    trace_end(trace, "record frame", "frame", rec->frames+1);
+    return TRUE;
+  }
+  cairo_surface_flush(rec->surface);
+
+  struct frame *f = g_new(struct frame, 1);
+  f->rec = rec;
+  f->surface = rec->surface;
+  f->number = ++rec->frames;
+  rec->surface = NULL;
+  end_frame(rec);
+  g_atomic_int_add(&rec->pending, 1);
+  g_thread_pool_push(rec->pool, f, NULL);
+  trace_end(trace, "record frame", "frame", f->number);
+  return FALSE;
+}
+
+void
+drop_frame(struct recorder *rec)
+/* Give up the frame being drawn, e.g. because newer data is waiting.
+ * The next frame is drawn once the data changes.  */
+{
+  if (! rec->surface) return;
+  end_frame(rec);
+  rec->dropped += 1;
+}
+
+gboolean
+stop_recording(struct recorder *rec, int *frames, int *dropped)
+/* Wait until all frames are written.  Returns FALSE if writing a
+ * frame failed.  */
+{
+  drop_frame(rec);
+  g_thread_pool_free(rec->pool, FALSE, TRUE);
+  gboolean ok = ! rec->failed;
+  if (rec->raw && fclose(rec->raw) != 0) ok = FALSE;
+  if (frames) *frames = rec->frames;
+  if (dropped) *dropped = rec->dropped;
+
+  if (rec->density_cache) delete_density_cache(rec->density_cache);
+  if (rec->matrix_cache) delete_matrix_cache(rec->matrix_cache);
+  g_free(rec->prefix);
+  g_free(rec);
+  return ok;
+}
@@ -0,0 +1,323 @@
+/* reduce.c - keep large datasets within the memory budget
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "jvqplot.h"
+
+
+/* While the x-values are increasing, the rows are grouped into
+ * buckets of `span' consecutive rows, and every bucket is stored as
+ * four rows: the first row, the minima, the maxima and the last row.
+ * Whenever the buckets fill the budget, neighbouring buckets are
+ * merged.  Drawn as a line, this covers the same pixels as the full
+ * data, as long as a bucket is narrower than a pixel.
+ *
+ * Once the x-values decrease, the data is a point cloud and a uniform
+ * random sample of the rows is kept instead (Vitter's algorithm R).
+ * The sample is sorted by row number at the end of every load, so
+ * that lines still connect the rows in file order.  */
+struct reduction {
+  int max_rows;                 /* rows which fit into the budget */
+  gint64 seen;                  /* rows read from the file */
+  gint64 span;                  /* rows per bucket, 0 when sampling */
+  gint64 filled;                /* rows in the last bucket */
+  gint64 *row;                  /* row numbers of the sample */
+  guint64 rng;
+};
+
+#define ROW(ds, i) ((ds)->data + (gsize)(i)*(ds)->cols)
+
+
+static void
+touch(struct dataset *ds, int i)
+/* Row `i' is about to change.  */
+{
+  if (ds->stable_rows > i) ds->stable_rows = i;
+}
+
+static guint64
+next_random(struct reduction *r)
+/* xorshift64* */
+{
+  r->rng ^= r->rng >> 12;
+  r->rng ^= r->rng << 25;
+  r->rng ^= r->rng >> 27;
+  return r->rng * G_GUINT64_CONSTANT(2685821657736338717);
+}
+
+static void
+merge_buckets(struct dataset *ds, int a, int b, int out, double *tmp)
+{
+  int cols = ds->cols;
+  double *pa = ROW(ds, 4*a);
+  double *pb = ROW(ds, 4*b);
+  int j;
+
+  memcpy(tmp, pa, cols*sizeof(double));
+  tmp[cols] = pa[cols];
+  tmp[2*cols] = pb[2*cols];
+  for (j=1; j<cols; ++j) {
+    tmp[cols+j] = MIN(pa[cols+j], pb[cols+j]);
+    tmp[2*cols+j] = MAX(pa[2*cols+j], pb[2*cols+j]);
+  }
+  memcpy(tmp+3*cols, pb+3*cols, cols*sizeof(double));
+  memcpy(ROW(ds, 4*out), tmp, 4*cols*sizeof(double));
+}
+
+static void
+halve_buckets(struct dataset *ds)
+{
+  struct reduction *r = ds->reduction;
+  int nb = ds->rows/4;
+  double *tmp = g_new(double, 4*ds->cols);
+  int b;
+
+  touch(ds, 0);
+  for (b=0; 2*b+1<nb; ++b) merge_buckets(ds, 2*b, 2*b+1, b, tmp);
+  g_free(tmp);
+  if (nb % 2) {
+    /* the last bucket is not full yet, it stays on its own */
+    memmove(ROW(ds, 4*b), ROW(ds, 4*(nb-1)), 4*ds->cols*sizeof(double));
+    b += 1;
+  } else {
+    r->filled += r->span;
+  }
+  ds->rows = 4*b;
+  r->span *= 2;
+}
+
+static void
+add_to_bucket(struct dataset *ds)
+{
+  struct reduction *r = ds->reduction;
+  int cols = ds->cols;
+  double *row = ROW(ds, ds->rows);
+  int j, k;
+
+  if (r->filled < r->span) {
+    double *b = ROW(ds, ds->rows-4);
+    touch(ds, ds->rows-3);
+    for (j=1; j<cols; ++j) {
+      if (row[j] < b[cols+j]) b[cols+j] = row[j];
+      if (row[j] > b[2*cols+j]) b[2*cols+j] = row[j];
+    }
+    b[2*cols] = row[0];
+    memcpy(b+3*cols, row, cols*sizeof(double));
+    r->filled += 1;
+    return;
+  }
+
+  /* start a new bucket */
+  for (k=1; k<4; ++k) {
+    memcpy(ROW(ds, ds->rows+k), row, cols*sizeof(double));
+  }
+  ds->rows += 4;
+  r->filled = 1;
+  if (ds->rows > r->max_rows-4) halve_buckets(ds);
+}
+
+static void
+add_to_sample(struct dataset *ds)
+{
+  struct reduction *r = ds->reduction;
+  int cols = ds->cols;
+
+  if (ds->rows < r->max_rows) {
+    r->row[ds->rows] = r->seen-1;
+    ds->rows += 1;
+    return;
+  }
+  guint64 k = next_random(r) % (guint64)r->seen;
+  if (k < (guint64)ds->rows) {
+    touch(ds, k);
+    memcpy(ROW(ds, k), ROW(ds, ds->rows), cols*sizeof(double));
+    r->row[k] = r->seen-1;
+  }
+}
+
+static void
+start_sampling(struct dataset *ds)
+/* Switch from buckets to sampling.  The bucket rows are taken as the
+ * sample so far, which makes the sample only approximately uniform.  */
+{
+  struct reduction *r = ds->reduction;
+  int i;
+
+  r->span = 0;
+  r->row = g_new(gint64, r->max_rows);
+  for (i=0; i<ds->rows; ++i) {
+    r->row[i] = (gint64)((double)i/ds->rows * (r->seen-1));
+  }
+}
+
+void
+reduce_start(struct dataset *ds, int max_rows)
+{
+  struct reduction *r = g_new0(struct reduction, 1);
+  int cols = ds->cols;
+  int rows = ds->rows;
+  int i, j;
+
+  r->max_rows = max_rows;
+  r->seen = rows;
+  r->rng = G_GUINT64_CONSTANT(0x9e3779b97f4a7c15) ^ (guint64)rows;
+  ds->reduction = r;
+  ds->stable_rows = 0;
+  g_free(ds->offset);           /* the rows are no longer those of the file */
+  ds->offset = NULL;
+
+  gboolean increasing = TRUE;
+  for (i=1; i<rows && increasing; ++i) {
+    if (! (ROW(ds, i)[0] >= ROW(ds, i-1)[0])) increasing = FALSE;
+  }
+
+  if (! increasing) {
+    /* the last row is added like any later one */
+    ds->rows = rows-1;
+    start_sampling(ds);
+    add_to_sample(ds);
+    return;
+  }
+
+  /* Use at most half of the space, so that there is room to grow.
+   * Since every bucket has at least eight rows, the buckets can be
+   * written in place.  */
+  gint64 span = 1;
+  while ((rows+span-1)/span > max_rows/8) span *= 2;
+  int nb = (rows+span-1)/span;
+  double *tmp = g_new(double, 4*cols);
+  for (i=0; i<nb; ++i) {
+    int from = i*span;
+    int to = MIN(from+span, rows);
+    double *first = ROW(ds, from);
+    memcpy(tmp, first, cols*sizeof(double));
+    memcpy(tmp+cols, first, cols*sizeof(double));
+    memcpy(tmp+2*cols, first, cols*sizeof(double));
+    int k;
+    for (k=from+1; k<to; ++k) {
+      double *row = ROW(ds, k);
+      for (j=1; j<cols; ++j) {
+        if (row[j] < tmp[cols+j]) tmp[cols+j] = row[j];
+        if (row[j] > tmp[2*cols+j]) tmp[2*cols+j] = row[j];
+      }
+    }
+    tmp[2*cols] = ROW(ds, to-1)[0];
+    memcpy(tmp+3*cols, ROW(ds, to-1), cols*sizeof(double));
+    memcpy(ROW(ds, 4*i), tmp, 4*cols*sizeof(double));
+  }
+  g_free(tmp);
+  ds->rows = 4*nb;
+  r->span = span;
+  r->filled = rows - (gint64)(nb-1)*span;
+}
+
+void
+reduce_add(struct dataset *ds)
+{
+  struct reduction *r = ds->reduction;
+
+  r->seen += 1;
+  if (r->span) {
+    if (ROW(ds, ds->rows)[0] >= ROW(ds, ds->rows-1)[0]) {
+      add_to_bucket(ds);
+      return;
+    }
+    start_sampling(ds);
+  }
+  add_to_sample(ds);
+}
+
+static int
+compare_rows(gconstpointer a, gconstpointer b, gpointer data)
+{
+  const gint64 *row = data;
+  gint64 ra = row[*(const int *)a];
+  gint64 rb = row[*(const int *)b];
+
+  return (ra > rb) - (ra < rb);
+}
+
+void
+reduce_finish(struct dataset *ds)
+{
+  struct reduction *r = ds->reduction;
+  int cols = ds->cols;
+  int i;
+
+  if (r->span) return;
+
+  /* put the sample back into file order, by following the cycles of
+   * the permutation */
+  int *order = g_new(int, ds->rows);
+  int *pos = g_new(int, ds->rows);
+  for (i=0; i<ds->rows; ++i) order[i] = i;
+  g_qsort_with_data(order, ds->rows, sizeof(int), compare_rows, r->row);
+  for (i=0; i<ds->rows; ++i) pos[order[i]] = i;
+
+  double *tmp = g_new(double, cols);
+  for (i=0; i<ds->rows; ++i) {
+    if (pos[i] == i) continue;
+    touch(ds, i);
+    memcpy(tmp, ROW(ds, i), cols*sizeof(double));
+    gint64 n = r->row[i];
+    int k = i;
+    while (order[k] != i) {
+      int from = order[k];
+      memcpy(ROW(ds, k), ROW(ds, from), cols*sizeof(double));
+      r->row[k] = r->row[from];
+      pos[k] = k;
+      k = from;
+    }
+    memcpy(ROW(ds, k), tmp, cols*sizeof(double));
+    r->row[k] = n;
+    pos[k] = k;
+  }
+  g_free(tmp);
+  g_free(pos);
+  g_free(order);
+}
+
+gint64
+rows_read(const struct dataset *ds)
+{
+  return ds->reduction ? ds->reduction->seen : ds->rows;
+}
+
+struct reduction *
+copy_reduction(const struct reduction *r)
+{
+  struct reduction *copy = g_memdup(r, sizeof(struct reduction));
+
+  if (r->row) copy->row = g_memdup(r->row, r->max_rows*sizeof(gint64));
+  return copy;
+}
+
+void
+free_reduction(struct reduction *r)
+{
+  if (! r) return;
+  g_free(r->row);
+  g_free(r);
+}
@@ -0,0 +1,447 @@
+/* serve.c - render plots for clients connecting to a Unix socket
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <cairo.h>
+
+#include "jvqplot.h"
+
+
+/* Clients send one request per line, of the form
+ *
+ *   FILE WIDTH HEIGHT FORMAT
+ *
+ * where FORMAT is "png", "pdf" or "svg"; for PDF and SVG, the size is
+ * given in points and the data is reduced to the resolution chosen
+ * for the server.  The answer is either a line "OK LENGTH",
+ * followed by LENGTH bytes of image data, or a line "ERROR MESSAGE".
+ * Several requests can be sent over one connection.
+ *
+ * The parsed data files are kept in memory, until the total size of
+ * the data and of the cached images exceeds the budget.  Since every
+ * thread of the server may be reading a file, each file may only use
+ * a share of the budget, larger files are reduced (see "reduce.c"),
+ * and a file being read counts with its full share.  Files are
+ * watched for changes, and changed files are reloaded on the next
+ * request, so that appended data only needs to be processed once.  */
+
+/* Number of rendered images kept per file.  */
+#define N_IMAGES 4
+
+#define MAX_IMAGE_SIZE 10000
+
+
+struct image {
+  unsigned generation;
+  int width, height;
+  gchar *format;
+  GBytes *bytes;
+  gint64 last_used;
+};
+
+struct entry {
+  gchar *path;
+  GMutex lock;                  /* protects the fields below */
+  struct state *state;
+  gboolean loaded;
+  gint stale;                   /* the file changed, set atomically */
+  GFileMonitor *monitor;
+  struct image image[N_IMAGES];
+
+  /* protected by the server lock */
+  int users;
+  gint64 last_used;
+  gsize bytes;
+};
+
+struct server {
+  GMutex lock;
+  GHashTable *entries;          /* path -> struct entry */
+  gsize budget;
+  gsize share;                  /* the data budget of one file */
+  int dpi;                      /* resolution for PDF and SVG images */
+};
+
+
+static gsize
+entry_bytes(struct entry *e)
+{
+  gsize bytes = 0;
+  int i, k;
+
+  for (k=0; k<e->state->dataset_used; ++k) {
+    bytes += dataset_bytes(&e->state->dataset[k]);
+  }
+  for (i=0; i<N_IMAGES; ++i) {
+    if (e->image[i].bytes) bytes += g_bytes_get_size(e->image[i].bytes);
+  }
+  return bytes;
+}
+
+static void
+free_entry(struct entry *e)
+{
+  int i;
+
+  if (e->monitor) g_object_unref(e->monitor);
+  for (i=0; i<N_IMAGES; ++i) {
+    g_free(e->image[i].format);
+    if (e->image[i].bytes) g_bytes_unref(e->image[i].bytes);
+  }
+  delete_state(e->state);
+  g_mutex_clear(&e->lock);
+  g_free(e->path);
+  g_free(e);
+}
+
+static void
+file_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                GFileMonitorEvent event_type, gpointer data)
+/* This runs in the thread of serve_plots(), the entry may have been
+ * evicted in the meantime, so we look it up again.  */
+{
+  struct server *server = data;
+
+  gchar *path = g_file_get_path(file);
+  g_mutex_lock(&server->lock);
+  struct entry *e = g_hash_table_lookup(server->entries, path);
+  if (e) g_atomic_int_set(&e->stale, 1);
+  g_mutex_unlock(&server->lock);
+  g_free(path);
+}
+
+static void
+evict(struct server *server)
+/* Remove the least recently used entries, until the cache fits into
+ * the budget again.  Entries currently in use are kept.  Must be
+ * called with the server lock held.  */
+{
+  for (;;) {
+    GHashTableIter iter;
+    gpointer value;
+    struct entry *oldest = NULL;
+    gsize total = 0;
+
+    g_hash_table_iter_init(&iter, server->entries);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      struct entry *e = value;
+      total += e->users ? MAX(e->bytes, server->share) : e->bytes;
+      if (e->users == 0
+          && (! oldest || e->last_used < oldest->last_used)) {
+        oldest = e;
+      }
+    }
+    if (total <= server->budget || ! oldest) break;
+
+    g_hash_table_remove(server->entries, oldest->path);
+    free_entry(oldest);
+  }
+}
+
+static struct entry *
+get_entry(struct server *server, const gchar *path)
+{
+  g_mutex_lock(&server->lock);
+  struct entry *e = g_hash_table_lookup(server->entries, path);
+  if (! e) {
+    e = g_new0(struct entry, 1);
+    e->path = g_strdup(path);
+    g_mutex_init(&e->lock);
+    e->state = new_state();
+    e->state->memory_budget = server->share;
+    GFile *file = g_file_new_for_path(path);
+    add_source(e->state, file);
+    g_object_unref(file);
+    g_hash_table_insert(server->entries, e->path, e);
+  }
+  e->users += 1;
+  e->last_used = g_get_monotonic_time();
+  /* make room for reading the file */
+  evict(server);
+  g_mutex_unlock(&server->lock);
+  return e;
+}
+
+static void
+release_entry(struct server *server, struct entry *e, gsize bytes)
+{
+  g_mutex_lock(&server->lock);
+  e->users -= 1;
+  e->bytes = bytes;
+  evict(server);
+  g_mutex_unlock(&server->lock);
+}
+
+static cairo_status_t
+append_bytes(void *closure, const unsigned char *data, unsigned int length)
+{
+  g_byte_array_append(closure, data, length);
+  return CAIRO_STATUS_SUCCESS;
+}
+
+static GBytes *
+render(struct state *state, int width, int height, const gchar *format,
+       int dpi, GError **err)
+{
+  if (strcmp(format, "pdf") == 0 || strcmp(format, "svg") == 0) {
+    GByteArray *buffer = g_byte_array_new();
+    cairo_status_t rc = write_vector_plot(state, format, width, height, dpi,
+                                          append_bytes, buffer);
+    if (rc != CAIRO_STATUS_SUCCESS) {
+      g_byte_array_free(buffer, TRUE);
+      g_set_error(err, G_IO_ERROR, G_IO_ERROR_FAILED,
+                  "cannot render %s (%s)", format,
+                  cairo_status_to_string(rc));
+      return NULL;
+    }
+    return g_byte_array_free_to_bytes(buffer);
+  }
+  if (strcmp(format, "png") != 0) {
+    g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                "unknown format \"%s\"", format);
+    return NULL;
+  }
+
+  struct layout *L = new_layout(width, height, state->xres, state->yres,
+                                state->min[0], state->max[0],
+                                state->min[1], state->max[1],
+                                state->time_axis);
+  cairo_surface_t *surface
+    = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+  cairo_t *cr = cairo_create(surface);
+  draw_graph(state, cr, L, FALSE);
+  cairo_destroy(cr);
+  delete_layout(L);
+
+  GByteArray *buffer = g_byte_array_new();
+  cairo_surface_write_to_png_stream(surface, append_bytes, buffer);
+  cairo_surface_destroy(surface);
+  return g_byte_array_free_to_bytes(buffer);
+}
+
+static GBytes *
+get_image(struct server *server, struct entry *e,
+          int width, int height, const gchar *format, GError **err)
+/* Must be called with the entry lock held.  */
+{
+  struct state *state = e->state;
+  int i;
+
+  if (! e->loaded || g_atomic_int_compare_and_exchange(&e->stale, 1, 0)) {
+    read_data(state, 0);
+    e->loaded = TRUE;
+  }
+  if (! e->monitor) {
+    e->monitor = g_file_monitor_file(state->source[0].file, 0, NULL, NULL);
+    if (e->monitor) {
+      g_signal_connect(e->monitor, "changed",
+                       G_CALLBACK(file_changed_cb), server);
+    }
+  }
+  if (! state->dataset_used) {
+    g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s",
+                state->message ? state->message : "no data");
+    return NULL;
+  }
+
+  struct image *oldest = &e->image[0];
+  for (i=0; i<N_IMAGES; ++i) {
+    struct image *im = &e->image[i];
+    if (im->bytes && im->generation == state->generation
+        && im->width == width && im->height == height
+        && strcmp(im->format, format) == 0) {
+      im->last_used = g_get_monotonic_time();
+      return g_bytes_ref(im->bytes);
+    }
+    if (im->last_used < oldest->last_used) oldest = im;
+  }
+
+  GBytes *bytes = render(state, width, height, format, server->dpi, err);
+  if (! bytes) return NULL;
+  g_free(oldest->format);
+  if (oldest->bytes) g_bytes_unref(oldest->bytes);
+  oldest->generation = state->generation;
+  oldest->width = width;
+  oldest->height = height;
+  oldest->format = g_strdup(format);
+  oldest->bytes = g_bytes_ref(bytes);
+  oldest->last_used = g_get_monotonic_time();
+  return bytes;
+}
+
+static gboolean
+split_request(gchar *line, gchar *field[3])
+/* Split `line' in place into the file name, which is left in `line',
+ * and the three fields after it.  File names may contain spaces, so
+ * the fields are taken from the end, and they may be separated by
+ * several spaces or tabs.  */
+{
+  gchar *end = line + strlen(line);
+  int i;
+
+  for (i=2; i>=0; --i) {
+    while (end > line && g_ascii_isspace(end[-1])) --end;
+    *end = '\0';
+    while (end > line && ! g_ascii_isspace(end[-1])) --end;
+    field[i] = end;
+    if (! *end || end == line) return FALSE;
+  }
+  while (end > line && g_ascii_isspace(end[-1])) --end;
+  *end = '\0';
+  return end > line;
+}
+
+static GBytes *
+handle_request(struct server *server, const gchar *request, GError **err)
+{
+  GBytes *bytes = NULL;
+  gchar *field[3];
+
+  gchar *name = g_strdup(request);
+  if (! split_request(name, field)) {
+    g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "malformed request");
+    goto out;
+  }
+  int width = atoi(field[0]);
+  int height = atoi(field[1]);
+  const gchar *format = field[2];
+  if (width < 1 || width > MAX_IMAGE_SIZE
+      || height < 1 || height > MAX_IMAGE_SIZE) {
+    g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "invalid image size");
+    goto out;
+  }
+
+  GFile *file = g_file_new_for_path(name);
+  gchar *path = g_file_get_path(file);
+  g_object_unref(file);
+
+  struct entry *e = get_entry(server, path);
+  g_mutex_lock(&e->lock);
+  bytes = get_image(server, e, width, height, format, err);
+  gsize size = entry_bytes(e);
+  g_mutex_unlock(&e->lock);
+  release_entry(server, e, size);
+  g_free(path);
+
+ out:
+  g_free(name);
+  return bytes;
+}
+
+static gboolean
+run_cb(GThreadedSocketService *service, GSocketConnection *connection,
+       GObject *source_object, gpointer data)
+/* This runs in a thread of the socket service, once per connection.  */
+{
+  struct server *server = data;
+  GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+  GOutputStream *out
+    = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+  GDataInputStream *lines = g_data_input_stream_new(in);
+  gchar *request;
+
+  while ((request = g_data_input_stream_read_line(lines, NULL, NULL, NULL))) {
+    GError *err = NULL;
+    GBytes *bytes = handle_request(server, request, &err);
+    g_free(request);
+
+    gchar *header;
+    gsize size = 0;
+    if (bytes) {
+      size = g_bytes_get_size(bytes);
+      header = g_strdup_printf("OK %" G_GSIZE_FORMAT "\n", size);
+    } else {
+      header = g_strdup_printf("ERROR %s\n", err->message);
+      g_clear_error(&err);
+    }
+    gboolean ok = g_output_stream_write_all(out, header, strlen(header),
+                                            NULL, NULL, NULL);
+    g_free(header);
+    if (ok && bytes) {
+      ok = g_output_stream_write_all(out, g_bytes_get_data(bytes, NULL),
+                                     size, NULL, NULL, NULL);
+    }
+    if (bytes) g_bytes_unref(bytes);
+    if (! ok) break;
+  }
+
+  g_object_unref(lines);
+  return TRUE;
+}
+
+gboolean
+serve_plots(const gchar *socket_path, gsize budget, int dpi, int max_threads,
+            GError **err)
+{
+  struct server server;
+
+  g_mutex_init(&server.lock);
+  server.entries = g_hash_table_new(g_str_hash, g_str_equal);
+  server.budget = budget;
+  server.share = budget ? MAX(budget / MAX(max_threads, 1), 1) : 0;
+  server.dpi = dpi;
+
+  /* remove a socket left over from an earlier run, but nothing else */
+  GStatBuf st;
+  if (g_lstat(socket_path, &st) == 0) {
+    if (! S_ISSOCK(st.st_mode)) {
+      g_set_error(err, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                  "file exists and is not a socket");
+      g_hash_table_destroy(server.entries);
+      g_mutex_clear(&server.lock);
+      return FALSE;
+    }
+    g_unlink(socket_path);
+  }
+
+  GSocketService *service = g_threaded_socket_service_new(max_threads);
+  GSocketAddress *address = g_unix_socket_address_new(socket_path);
+  gboolean ok = g_socket_listener_add_address(G_SOCKET_LISTENER(service),
+                                              address,
+                                              G_SOCKET_TYPE_STREAM,
+                                              G_SOCKET_PROTOCOL_DEFAULT,
+                                              NULL, NULL, err);
+  g_object_unref(address);
+  if (! ok) {
+    g_object_unref(service);
+    g_hash_table_destroy(server.entries);
+    g_mutex_clear(&server.lock);
+    return FALSE;
+  }
+
+  g_signal_connect(service, "run", G_CALLBACK(run_cb), &server);
+  g_socket_service_start(service);
+
+  /* file change notifications are delivered here */
+  GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+  g_main_loop_run(loop);
+  return TRUE;
+}
@@ -0,0 +1,120 @@
+/* stats.c - performance counters
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include <glib.h>
+
+#include "jvqplot.h"
+
+
+const char *const stage_name[N_STAGES] = {
+  "open", "parse", "update", "layout", "draw",
+};
+
+
+void
+stats_start(struct state *state, enum stage stage)
+{
+  struct stats *stats = &state->stats;
+
+  stats->start[stage] = g_get_monotonic_time();
+}
+
+void
+stats_stop(struct state *state, enum stage stage)
+{
+  struct stats *stats = &state->stats;
+
+  stats->usec[stage] = g_get_monotonic_time() - stats->start[stage];
+}
+
+double
+stats_fps(struct state *state)
+/* The frame rate over the last (up to) FPS_FRAMES frames, not
+ * counting frames from more than two seconds ago.  */
+{
+  struct stats *stats = &state->stats;
+  gint64 now = g_get_monotonic_time();
+  int n = MIN(stats->n_frames, FPS_FRAMES);
+  int i, used = 0;
+  gint64 first = now;
+
+  for (i=0; i<n; ++i) {
+    gint64 t = stats->frame_time[(stats->n_frames-1-i) % FPS_FRAMES];
+    if (now - t > 2*G_USEC_PER_SEC) break;
+    first = t;
+    used += 1;
+  }
+  if (used < 2) return 0;
+  return (used-1) * (double)G_USEC_PER_SEC / (now - first);
+}
+
+void
+stats_reload_done(struct state *state)
+{
+  struct stats *stats = &state->stats;
+  int k;
+
+  if (! stats->enabled) return;
+
+  gsize bytes = 0;
+  for (k=0; k<state->dataset_used; ++k) {
+    bytes += dataset_bytes(&state->dataset[k]);
+  }
+  fprintf(stats->out,
+          "reload t=%" G_GINT64_FORMAT " open=%" G_GINT64_FORMAT
+          " parse=%" G_GINT64_FORMAT " update=%" G_GINT64_FORMAT
+          " datasets=%d reused=%d bytes=%" G_GSIZE_FORMAT
+          " events=%d coalesced=%d\n",
+          g_get_monotonic_time(), stats->usec[STAGE_OPEN],
+          stats->usec[STAGE_PARSE], stats->usec[STAGE_UPDATE],
+          state->dataset_used, stats->datasets_reused, bytes,
+          stats->events, stats->events_coalesced);
+  for (k=0; k<state->dataset_used; ++k) {
+    struct dataset *ds = &state->dataset[k];
+    fprintf(stats->out,
+            "dataset index=%d rows=%d cols=%d bytes=%" G_GSIZE_FORMAT "\n",
+            k, ds->rows, ds->cols, dataset_bytes(ds));
+  }
+  fflush(stats->out);
+}
+
+void
+stats_frame_done(struct state *state, double submitted, double drawn)
+{
+  struct stats *stats = &state->stats;
+
+  stats->frame_time[stats->n_frames % FPS_FRAMES] = g_get_monotonic_time();
+  stats->n_frames += 1;
+  stats->points_submitted = submitted;
+  stats->points_drawn = drawn;
+
+  if (! stats->enabled) return;
+
+  fprintf(stats->out,
+          "frame t=%" G_GINT64_FORMAT " layout=%" G_GINT64_FORMAT
+          " draw=%" G_GINT64_FORMAT " fps=%.1f submitted=%.0f drawn=%.0f\n",
+          g_get_monotonic_time(), stats->usec[STAGE_LAYOUT],
+          stats->usec[STAGE_DRAW], stats_fps(state), submitted, drawn);
+  fflush(stats->out);
+}
@@ -0,0 +1,106 @@
+/* columns.c - check hiding and showing columns of a data file
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "jvqplot.h"
+
+
+/* A CSV file with a header row.  Hiding a column and showing it again
+ * reads the hidden column from the file, without parsing the other
+ * columns again.  */
+static const gchar csv[] =
+  "# comment\n"
+  "t,a,b\n"
+  "1,10,100\n"
+  "2,20,200\n"
+  "3,30,300\n";
+
+static int failed = 0;
+
+static void
+check(struct state *state, const gchar *what, int cols, const double *want)
+{
+  const struct dataset *ds = &state->dataset[0];
+  int i, j;
+
+  if (state->message) {
+    fprintf(stderr, "FAIL: %s: %s\n", what, state->message);
+    failed = 1;
+    return;
+  }
+  if (state->dataset_used != 1 || ds->rows != 3 || ds->cols != cols) {
+    fprintf(stderr, "FAIL: %s: %d datasets, %d rows, %d columns\n",
+            what, state->dataset_used, ds->rows, ds->cols);
+    failed = 1;
+    return;
+  }
+  for (i=0; i<ds->rows; ++i) {
+    for (j=0; j<cols; ++j) {
+      if (ds->data[i*cols+j] == want[i*cols+j]) continue;
+      fprintf(stderr, "FAIL: %s: row %d, column %d is %g, not %g\n",
+              what, i, j, ds->data[i*cols+j], want[i*cols+j]);
+      failed = 1;
+    }
+  }
+}
+
+int
+main(void)
+{
+  static const double all[] = { 1, 10, 100, 2, 20, 200, 3, 30, 300 };
+  static const double hidden[] = { 1, 100, 2, 200, 3, 300 };
+  GError *err = NULL;
+  gchar *path;
+
+  int fd = g_file_open_tmp("jvqplot-test-XXXXXX", &path, &err);
+  if (fd < 0 || ! g_file_set_contents(path, csv, -1, &err)) {
+    fprintf(stderr, "error: cannot write test file: %s\n", err->message);
+    return 1;
+  }
+  close(fd);
+
+  struct state *state = new_state();
+  GFile *file = g_file_new_for_path(path);
+  add_source(state, file);
+  g_object_unref(file);
+
+  read_data(state, 0);
+  check(state, "all columns", 3, all);
+  set_column_hidden(&state->columns, 1, TRUE);
+  read_data(state, 0);
+  check(state, "column a hidden", 2, hidden);
+  set_column_hidden(&state->columns, 1, FALSE);
+  read_data(state, 0);
+  check(state, "column a shown again", 3, all);
+
+  delete_state(state);
+  g_unlink(path);
+  g_free(path);
+  return failed;
+}
@@ -0,0 +1,122 @@
+/* layers.c - check that appending rows only redraws one layer
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <cairo.h>
+
+#include "jvqplot.h"
+
+
+/* 40 datasets with enough points together to be drawn in layers, one
+ * per dataset.  Rows are appended to the last dataset, inside the
+ * range of the plot.  */
+#define DATASETS 40
+#define ROWS 3000
+
+static void
+write_rows(FILE *out, int from, int to)
+{
+  int i;
+
+  for (i=from; i<to; ++i) fprintf(out, "%d %d\n", i, i%7);
+}
+
+static void
+draw(struct state *state, struct layout *L, cairo_surface_t *surface)
+{
+  cairo_t *cr = cairo_create(surface);
+  draw_graph(state, cr, L, FALSE);
+  cairo_destroy(cr);
+}
+
+int
+main(void)
+{
+  GError *err = NULL;
+  gchar *path;
+  int failed = 0;
+  int k;
+
+  /* with one processor, the layers are not used */
+  if (g_get_num_processors() < 2) return 77;
+
+  int fd = g_file_open_tmp("jvqplot-test-XXXXXX", &path, &err);
+  if (fd < 0) {
+    fprintf(stderr, "error: cannot create test file: %s\n", err->message);
+    return 1;
+  }
+  close(fd);
+  FILE *out = g_fopen(path, "w");
+  for (k=0; k<DATASETS; ++k) {
+    if (k > 0) fputs("\n", out);
+    write_rows(out, 0, k < DATASETS-1 ? ROWS : ROWS/2);
+  }
+  fclose(out);
+
+  struct state *state = new_state();
+  GFile *file = g_file_new_for_path(path);
+  add_source(state, file);
+  g_object_unref(file);
+  read_data(state, 0);
+
+  cairo_surface_t *surface
+    = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 400, 300);
+  struct layout *L = new_layout(400, 300, state->xres, state->yres,
+                                state->min[0], state->max[0],
+                                state->min[1], state->max[1],
+                                state->time_axis);
+  draw(state, L, surface);
+  if (state->stats.layers != DATASETS
+      || state->stats.layers_drawn != DATASETS) {
+    fprintf(stderr, "FAIL: first frame: %d of %d layers drawn\n",
+            state->stats.layers_drawn, state->stats.layers);
+    failed = 1;
+  }
+
+  out = g_fopen(path, "a");
+  write_rows(out, ROWS/2, ROWS/2+10);
+  fclose(out);
+  read_data(state, 0);
+  draw(state, L, surface);
+  if (state->message || state->dataset_used != DATASETS
+      || state->dataset[DATASETS-1].rows != ROWS/2+10) {
+    fprintf(stderr, "FAIL: the appended rows were not read\n");
+    failed = 1;
+  } else if (state->stats.layers_drawn != 1) {
+    fprintf(stderr, "FAIL: after appending: %d of %d layers drawn\n",
+            state->stats.layers_drawn, state->stats.layers);
+    failed = 1;
+  }
+
+  delete_layout(L);
+  cairo_surface_destroy(surface);
+  delete_state(state);
+  g_unlink(path);
+  g_free(path);
+  return failed;
+}
@@ -0,0 +1,193 @@
+/* timestamp.c - read and print ISO 8601 timestamps
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <math.h>
+
+#include <glib.h>
+
+#include "jvqplot.h"
+
+
+/* Timestamps are converted to seconds since 1970-01-01 00:00 UTC.
+ * Timestamps without a time zone are taken to be UTC, and the axis
+ * labels are printed in UTC, so that the labels show the times found
+ * in the file.  The calendar arithmetic is done here instead of using
+ * strptime() and gmtime(), which depend on the locale and are much
+ * slower than parsing a number.  */
+
+static const double pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+};
+#define MAX_DIGITS 15
+
+
+static gint64
+days_from_civil(gint64 y, int m, int d)
+/* The day number of a date in the proleptic Gregorian calendar,
+ * counting from 1970-01-01, after H. Hinnant's algorithm.  */
+{
+  y -= m <= 2;
+  gint64 era = (y >= 0 ? y : y-399) / 400;
+  int yoe = y - era*400;
+  int doy = (153*(m > 2 ? m-3 : m+9) + 2)/5 + d-1;
+  int doe = yoe*365 + yoe/4 - yoe/100 + doy;
+  return era*146097 + doe - 719468;
+}
+
+static void
+civil_from_days(gint64 z, int *y, int *m, int *d)
+/* The inverse of days_from_civil().  */
+{
+  z += 719468;
+  gint64 era = (z >= 0 ? z : z-146096) / 146097;
+  int doe = z - era*146097;
+  int yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+  int doy = doe - (365*yoe + yoe/4 - yoe/100);
+  int mp = (5*doy + 2)/153;
+  *d = doy - (153*mp + 2)/5 + 1;
+  *m = mp < 10 ? mp+3 : mp-9;
+  *y = yoe + era*400 + (*m <= 2);
+}
+
+static int
+digits(const gchar *s, int n)
+/* The value of `n' decimal digits, or -1 if there is a non-digit.  */
+{
+  int v = 0;
+  int i;
+
+  for (i=0; i<n; ++i) {
+    unsigned c = (guchar)s[i] - '0';
+    if (c > 9) return -1;
+    v = 10*v + c;
+  }
+  return v;
+}
+
+gboolean
+is_timestamp(const gchar *s, gsize len)
+{
+  return len >= 10 && s[4] == '-' && s[7] == '-'
+    && digits(s, 4) >= 0 && digits(s+5, 2) >= 0 && digits(s+8, 2) >= 0;
+}
+
+gboolean
+parse_timestamp(const gchar *s, gsize len, double *t)
+/* Accepts YYYY-MM-DD, optionally followed by Thh:mm, Thh:mm:ss or
+ * Thh:mm:ss.fff and a time zone Z, +hh, +hhmm or +hh:mm.  As RFC 3339
+ * allows, the T may be a space.  24:00 is the end of the day.  */
+{
+  const gchar *end = s + len;
+
+  if (! is_timestamp(s, len)) return FALSE;
+  int m = digits(s+5, 2);
+  int d = digits(s+8, 2);
+  if (m < 1 || m > 12 || d < 1 || d > 31) return FALSE;
+  gint64 sec = days_from_civil(digits(s, 4), m, d) * 86400;
+  double frac = 0;
+  s += 10;
+
+  if (s < end && (*s == 'T' || *s == 't' || *s == ' ')) {
+    if (end-s < 6 || s[3] != ':') return FALSE;
+    int hh = digits(s+1, 2);
+    int mm = digits(s+4, 2);
+    int ss = 0;
+    if (hh < 0 || hh > 24 || mm < 0 || mm > 59) return FALSE;
+    sec += hh*3600 + mm*60;
+    s += 6;
+    if (s < end && *s == ':') {
+      ss = end-s >= 3 ? digits(s+1, 2) : -1;
+      if (ss < 0 || ss > 60) return FALSE;
+      sec += ss;
+      s += 3;
+      if (s < end && (*s == '.' || *s == ',')) {
+        gint64 f = 0;
+        int n = 0;
+        ++s;
+        while (s < end && (unsigned)((guchar)*s - '0') <= 9) {
+          /* further digits are below the precision of the result */
+          if (n < MAX_DIGITS) f = 10*f + (*s - '0'), ++n;
+          ++s;
+        }
+        if (! n) return FALSE;
+        frac = f / pow10[n];
+      }
+    }
+    if (hh == 24 && (mm || ss || frac)) return FALSE;
+
+    if (s < end && (*s == 'Z' || *s == 'z')) {
+      ++s;
+    } else if (s < end && (*s == '+' || *s == '-')) {
+      int sign = *s == '-' ? -1 : 1;
+      int zh = end-s >= 3 ? digits(s+1, 2) : -1;
+      int zm = 0;
+      if (zh < 0) return FALSE;
+      s += 3;
+      if (s < end && *s == ':') ++s;
+      if (s < end) {
+        zm = end-s >= 2 ? digits(s, 2) : -1;
+        if (zm < 0) return FALSE;
+        s += 2;
+      }
+      sec -= sign * (zh*3600 + zm*60);
+    }
+  }
+  if (s != end) return FALSE;
+
+  *t = sec + frac;
+  return TRUE;
+}
+
+void
+format_time(double t, double step, gchar *buffer, gsize size)
+/* Print the time `t' as an axis label, with the precision needed for
+ * labels `step' seconds apart.  Whole days are shown as dates.  */
+{
+  int n = 0;
+  while (n < 9 && fabs(step*pow10[n] - floor(step*pow10[n] + .5)) > 1e-6)
+    ++n;
+
+  /* round first, so that 23:59:59.9999 does not show the wrong day */
+  gint64 units = floor(t*pow10[n] + .5);
+  gint64 scale = pow10[n];
+  gint64 sec = units / scale;
+  gint64 frac = units % scale;
+  if (frac < 0) frac += scale, sec -= 1;
+  gint64 day = sec / 86400;
+  int tod = sec % 86400;
+  if (tod < 0) tod += 86400, day -= 1;
+
+  if (step >= 86400 || (step >= 60 && tod == 0)) {
+    int y, m, d;
+    civil_from_days(day, &y, &m, &d);
+    snprintf(buffer, size, "%04d-%02d-%02d", y, m, d);
+  } else if (step >= 60) {
+    snprintf(buffer, size, "%02d:%02d", tod/3600, tod/60%60);
+  } else if (n == 0) {
+    snprintf(buffer, size, "%02d:%02d:%02d", tod/3600, tod/60%60, tod%60);
+  } else {
+    snprintf(buffer, size, "%02d:%02d:%02d.%0*" G_GINT64_FORMAT,
+             tod/3600, tod/60%60, tod%60, n, frac);
+  }
+}
@@ -0,0 +1,199 @@
+/* trace.c - record a timeline of the work done, for a trace viewer
+ *
+ * Copyright (C) 2012  Jochen Voss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "jvqplot.h"
+
+
+/* The trace is written in the trace event format of Chrome, which can
+ * be loaded into chrome://tracing or Perfetto.  Unlike the counters
+ * in "stats.c", tracing covers all threads, including the loaders,
+ * so there is one trace per process.
+ *
+ * Every thread collects its spans in its own buffer of TRACE_EVENTS
+ * entries, without locking.  Only when a buffer is full, or when the
+ * trace is stopped, the spans are written to the file under a lock.
+ * While tracing is off, trace_begin() only reads one variable.  */
+#define TRACE_EVENTS 4096
+
+struct trace_event {
+  const char *name;
+  gint64 start, usec;
+  const char *key;              /* an argument, or NULL */
+  gint64 value;
+};
+struct trace_buffer {
+  int tid;
+  gint used;                    /* written by the owning thread only */
+  int flushed;                  /* events already in the file */
+  struct trace_event event[TRACE_EVENTS];
+};
+
+static struct {
+  GMutex lock;
+  FILE *out;
+  gboolean first;
+  gint64 t0;
+  int threads;
+  GPtrArray *buffers;
+} trace;
+static gint trace_on = 0;
+
+static void free_buffer(gpointer data);
+static GPrivate trace_buffer = G_PRIVATE_INIT(free_buffer);
+
+
+static void
+write_events(struct trace_buffer *buf)
+/* Called with the lock held.  */
+{
+  int n = g_atomic_int_get(&buf->used);
+  int i;
+
+  for (i=buf->flushed; i<n && trace.out; ++i) {
+    struct trace_event *ev = &buf->event[i];
+    fprintf(trace.out, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%d,\"ts\":%" G_GINT64_FORMAT ",\"dur\":%"
+            G_GINT64_FORMAT, trace.first ? "" : ",", ev->name, buf->tid,
+            ev->start - trace.t0, ev->usec);
+    if (ev->key) {
+      fprintf(trace.out, ",\"args\":{\"%s\":%" G_GINT64_FORMAT "}",
+              ev->key, ev->value);
+    }
+    fputc('}', trace.out);
+    trace.first = FALSE;
+  }
+  buf->flushed = n;
+}
+
+static void
+free_buffer(gpointer data)
+/* Runs when a thread exits.  */
+{
+  struct trace_buffer *buf = data;
+
+  g_mutex_lock(&trace.lock);
+  write_events(buf);
+  if (trace.buffers) g_ptr_array_remove_fast(trace.buffers, buf);
+  g_mutex_unlock(&trace.lock);
+  g_free(buf);
+}
+
+static struct trace_buffer *
+thread_buffer(void)
+{
+  struct trace_buffer *buf = g_private_get(&trace_buffer);
+  if (buf) return buf;
+
+  buf = g_new(struct trace_buffer, 1);
+  buf->used = buf->flushed = 0;
+  g_mutex_lock(&trace.lock);
+  buf->tid = ++trace.threads;
+  if (trace.buffers) g_ptr_array_add(trace.buffers, buf);
+  g_mutex_unlock(&trace.lock);
+  g_private_set(&trace_buffer, buf);
+  return buf;
+}
+
+gboolean
+trace_start(const gchar *path, GError **err)
+{
+  FILE *out = g_fopen(path, "w");
+  if (! out) {
+    int saved = errno;
+    g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(saved),
+                "cannot open \"%s\": %s", path, g_strerror(saved));
+    return FALSE;
+  }
+
+  g_mutex_lock(&trace.lock);
+  trace.out = out;
+  trace.first = TRUE;
+  trace.t0 = g_get_monotonic_time();
+  if (! trace.buffers) trace.buffers = g_ptr_array_new();
+  fputs("{\"traceEvents\":[", out);
+  g_mutex_unlock(&trace.lock);
+  g_atomic_int_set(&trace_on, 1);
+  return TRUE;
+}
+
+void
+trace_stop(void)
+/* Write the spans of all threads and close the file.  Spans which
+ * other threads are adding at this moment may be lost.  */
+{
+  guint i;
+
+  g_atomic_int_set(&trace_on, 0);
+  g_mutex_lock(&trace.lock);
+  if (trace.out) {
+    for (i=0; i<trace.buffers->len; ++i) {
+      write_events(g_ptr_array_index(trace.buffers, i));
+    }
+    fputs("\n]}\n", trace.out);
+    fclose(trace.out);
+    trace.out = NULL;
+  }
+  g_mutex_unlock(&trace.lock);
+}
+
+gint64
+trace_begin(void)
+/* Returns 0 if tracing is off.  */
+{
+  if (! g_atomic_int_get(&trace_on)) return 0;
+  return g_get_monotonic_time();
+}
+
+void
+trace_end(gint64 begin, const char *name, const char *key, gint64 value)
+/* Add a span from `begin' until now.  `name' and `key' must be static
+ * strings, `key' can be NULL if there is no argument.  */
+{
+  if (! begin) return;
+
+  gint64 now = g_get_monotonic_time();
+  struct trace_buffer *buf = thread_buffer();
+  int i = buf->used;
+  if (i == TRACE_EVENTS) {
+    g_mutex_lock(&trace.lock);
+    write_events(buf);
+    buf->flushed = 0;
+    g_atomic_int_set(&buf->used, 0);
+    g_mutex_unlock(&trace.lock);
+    i = 0;
+  }
+
+  struct trace_event *ev = &buf->event[i];
+  ev->name = name;
+  ev->start = begin;
+  ev->usec = now - begin;
+  ev->key = key;
+  ev->value = value;
+  /* publish the event to trace_stop() */
+  g_atomic_int_set(&buf->used, i+1);
+}